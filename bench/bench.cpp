@@ -0,0 +1,269 @@
+#include <lib/archive.h>
+#include <lib/arguments.h>
+#include <lib/crc32c.h>
+#include <lib/error_codes.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <random>
+
+/*
+    Prints one JSON object per line for every benchmark:
+        throughput in MB/s of processed input over all runs
+        latency percentiles of a single run in microseconds
+*/
+
+using Clock = std::chrono::steady_clock;
+
+const uint16_t CHUNK_SIZES[] = {8, 16, 32, 64, 256, 1024, 4096};
+const size_t MEGABYTE = 1 << 20;
+const size_t CHUNKS_IN_RUN = 1 << 12;
+const size_t BYTES_IN_STREAM_RUN = 16 * MEGABYTE;
+
+volatile uint64_t result_sink; // Results stored here keep benchmarked calls from being optimized away
+
+struct Options {
+  uint64_t file_size = 16 * MEGABYTE;
+  uint64_t files_amount = 4;
+  uint64_t repeat = 5;
+  uint16_t threads_amount = ThreadPool::defaultThreadsAmount();
+  std::filesystem::path directory = std::filesystem::temp_directory_path() / "hamarc_bench";
+};
+
+void invalidArguments() {
+    std::cerr << "Invalid arguments\n";
+    exit(ERROR_INVALID_PARARMETER);
+}
+
+uint64_t parseNumber(const char* argument) {
+    char* end;
+    unsigned long long number = strtoull(argument, &end, 10);
+    if (*end != '\0' || end == argument || number == 0) {
+        invalidArguments();
+    }
+    return number;
+}
+
+double percentile(std::vector<double> values, double fraction) {
+    std::sort(values.begin(), values.end());
+    size_t position = static_cast<size_t>(fraction * (values.size() - 1) + 0.5);
+    return values[position];
+}
+
+// Runs f `runs` times and reports the throughput of bytes_per_run processed by every run
+void measure(const std::string& name, const std::string& parameters, uint64_t bytes_per_run, uint64_t runs,
+             const std::function<void()>& f) {
+    std::vector<double> latencies; // Microseconds
+    double total = 0;
+    for (uint64_t i = 0; i < runs; i++) {
+        auto start = Clock::now();
+        f();
+        double elapsed = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+        latencies.push_back(elapsed);
+        total += elapsed;
+    }
+    double throughput = total > 0 ? static_cast<double>(bytes_per_run) * runs / total * 1e6 / MEGABYTE : 0;
+    std::cout << "{\"benchmark\":\"" << name << "\"" << parameters
+              << ",\"runs\":" << runs
+              << ",\"bytes_per_run\":" << bytes_per_run
+              << ",\"mb_per_s\":" << throughput
+              << ",\"p50_us\":" << percentile(latencies, 0.5)
+              << ",\"p90_us\":" << percentile(latencies, 0.9)
+              << ",\"p99_us\":" << percentile(latencies, 0.99)
+              << ",\"max_us\":" << percentile(latencies, 1)
+              << "}\n";
+}
+
+std::vector<unsigned char> randomBytes(size_t amount, std::mt19937_64& generator) {
+    std::vector<unsigned char> bytes(amount);
+    for (size_t i = 0; i < amount; i += sizeof(uint64_t)) {
+        uint64_t value = generator();
+        std::memcpy(bytes.data() + i, &value, std::min(sizeof(uint64_t), amount - i));
+    }
+    return bytes;
+}
+
+// Last word of value, folded into result_sink so the work that built value can't be dropped
+uint64_t lastWord(const bits& value) {
+    uint8_t amount = std::min<size_t>(value.size(), Bits::BITS_IN_WORD);
+    return amount ? value.getWord(value.size() - amount, amount) : 0;
+}
+
+void benchmarkChunks(const Options& options, std::mt19937_64& generator) {
+    for (uint16_t chunk_size : CHUNK_SIZES) {
+        std::vector<unsigned char> data = randomBytes(CHUNKS_IN_RUN * chunk_size / BITS_IN_BYTE, generator);
+        bits source;
+        source.appendBytes(data.data(), data.size());
+        std::vector<bits> chunks(CHUNKS_IN_RUN);
+        for (size_t i = 0; i < CHUNKS_IN_RUN; i++) {
+            chunks[i] = source.view(i * chunk_size, chunk_size);
+            HammingCode::encodeChunk(chunks[i]);
+        }
+        uint8_t control_bits_amount = HammingCode::getControlBitsAmount(chunk_size);
+        std::string parameters = ",\"chunk_size\":" + std::to_string(chunk_size);
+        uint64_t bytes_per_run = data.size();
+
+        bits chunk;
+        measure("encode_chunk", parameters, bytes_per_run, options.repeat, [&] {
+          uint64_t checksum = 0;
+          for (size_t i = 0; i < CHUNKS_IN_RUN; i++) {
+              chunk = source.view(i * chunk_size, chunk_size);
+              HammingCode::encodeChunk(chunk);
+              checksum ^= lastWord(chunk);
+          }
+          result_sink = checksum;
+        });
+        measure("decode_chunk", parameters, bytes_per_run, options.repeat, [&] {
+          uint64_t checksum = 0;
+          for (size_t i = 0; i < CHUNKS_IN_RUN; i++) {
+              chunk = chunks[i];
+              checksum += HammingCode::decodeChunk(chunk, control_bits_amount);
+              checksum ^= lastWord(chunk);
+          }
+          result_sink = checksum;
+        });
+
+        bits encoded;
+        HammingCode::encodeChunks(source, chunk_size, encoded);
+        measure("encode_chunks", parameters, bytes_per_run, options.repeat, [&] {
+          bits result;
+          HammingCode::encodeChunks(source, chunk_size, result);
+          result_sink = lastWord(result);
+        });
+        measure("decode_chunks", parameters, bytes_per_run, options.repeat, [&] {
+          bits result;
+          uint64_t corrected = 0;
+          bool correct = HammingCode::decodeChunks(encoded, chunk_size, result, corrected);
+          result_sink = lastWord(result) ^ corrected ^ correct;
+        });
+    }
+
+    std::vector<unsigned char> data = randomBytes(BYTES_IN_STREAM_RUN, generator);
+    bits encoded;
+    HammingCode::encodeBytes(data.data(), data.size(), encoded);
+    std::vector<unsigned char> decoded(data.size());
+    std::string parameters = ",\"chunk_size\":" + std::to_string(HammingCode::BYTE_CHUNK_SIZE);
+    measure("encode_bytes", parameters, data.size(), options.repeat, [&] {
+      bits result;
+      HammingCode::encodeBytes(data.data(), data.size(), result);
+      result_sink = lastWord(result);
+    });
+    measure("decode_bytes", parameters, data.size(), options.repeat, [&] {
+      bool correct = HammingCode::decodeBytes(encoded, decoded.data());
+      result_sink = decoded.back() ^ correct;
+    });
+    measure("crc32c", "", data.size(), options.repeat, [&] {
+      result_sink = crc32c(data.data(), data.size());
+    });
+}
+
+void benchmarkStreams(const Options& options, std::mt19937_64& generator) {
+    std::vector<unsigned char> data = randomBytes(BYTES_IN_STREAM_RUN, generator);
+    bits source;
+    source.appendBytes(data.data(), data.size());
+    std::string path = (options.directory / "stream.bin").string();
+
+    measure("bit_writer", "", data.size(), options.repeat, [&] {
+      std::ofstream out(path, std::ios::out | std::ios::binary);
+      Bits::bitWriter writer(out);
+      writer.write(source);
+      writer.close();
+    });
+    measure("bit_reader_words", "", data.size(), options.repeat, [&] {
+      std::ifstream in(path, std::ios::in | std::ios::binary);
+      bitReader reader(in);
+      uint64_t checksum = 0;
+      for (size_t read = 0; read < source.size(); read += bitReader::MAX_WORD_READ) {
+          checksum ^= reader.readWord(std::min<size_t>(bitReader::MAX_WORD_READ, source.size() - read));
+      }
+      result_sink = checksum;
+    });
+    measure("bit_reader_blocks", "", data.size(), options.repeat, [&] {
+      std::ifstream in(path, std::ios::in | std::ios::binary);
+      bitReader reader(in);
+      bits block;
+      reader.read(block, source.size());
+      result_sink = lastWord(block);
+    });
+    std::filesystem::remove(path);
+}
+
+void benchmarkArchive(const Options& options, std::mt19937_64& generator) {
+    std::filesystem::path files_directory = options.directory / "files";
+    std::filesystem::path extract_directory = options.directory / "extracted";
+    std::filesystem::create_directories(files_directory);
+    std::filesystem::create_directories(extract_directory);
+    std::vector<std::string> file_paths;
+    for (uint64_t i = 0; i < options.files_amount; i++) {
+        file_paths.push_back((files_directory / ("file" + std::to_string(i) + ".bin")).string());
+        std::vector<unsigned char> data = randomBytes(options.file_size, generator);
+        std::ofstream file(file_paths.back(), std::ios::out | std::ios::binary);
+        file.write(reinterpret_cast<char*>(data.data()), data.size());
+    }
+    std::string archive_path = (options.directory / "bench.haf").string();
+    std::string extract_path = extract_directory.string();
+    uint64_t bytes_per_run = options.file_size * options.files_amount;
+    std::string parameters = ",\"file_size\":" + std::to_string(options.file_size)
+        + ",\"files\":" + std::to_string(options.files_amount)
+        + ",\"threads\":" + std::to_string(options.threads_amount);
+
+    measure("create", parameters, bytes_per_run, options.repeat, [&] {
+      CorrectingArchive archive(archive_path);
+      archive.setThreadsAmount(options.threads_amount);
+      archive.createEmptyArchive();
+      for (auto& file_path : file_paths) {
+          archive.appendFile(file_path, HammingCode::BYTE_CHUNK_SIZE);
+      }
+    });
+    measure("list", parameters, bytes_per_run, options.repeat, [&] {
+      CorrectingArchive archive(archive_path);
+      archive.listFiles();
+    });
+    for (bool mapped : {false, true}) {
+        measure(mapped ? "extract_mapped" : "extract", parameters, bytes_per_run, options.repeat, [&] {
+          CorrectingArchive archive(archive_path);
+          archive.setThreadsAmount(options.threads_amount);
+          archive.setMappedReading(mapped);
+          archive.extractAllFiles(extract_path);
+        });
+    }
+    std::filesystem::remove_all(files_directory);
+    std::filesystem::remove_all(extract_directory);
+    std::filesystem::remove(archive_path);
+}
+
+int main(int argc, char** argv) {
+    ArgumentParser ap = ArgumentParser(argc, argv);
+    size_t size_arg = ap.parseParameterizedArgument("-s", "--size", 1, false);
+    size_t count_arg = ap.parseParameterizedArgument("-n", "--count", 1, false);
+    size_t repeat_arg = ap.parseParameterizedArgument("-r", "--repeat", 1, false);
+    size_t threads_arg = ap.parseParameterizedArgument("-t", "--threads", 1, false);
+    size_t directory_arg = ap.parseParameterizedArgument("-d", "--dir", 1, false);
+
+    Options options;
+    if (size_arg != NULL) {
+        options.file_size = parseNumber(argv[size_arg]) * MEGABYTE;
+    }
+    if (count_arg != NULL) {
+        options.files_amount = parseNumber(argv[count_arg]);
+    }
+    if (repeat_arg != NULL) {
+        options.repeat = parseNumber(argv[repeat_arg]);
+    }
+    if (threads_arg != NULL) {
+        options.threads_amount = std::min<uint64_t>(parseNumber(argv[threads_arg]), UINT16_MAX);
+    }
+    if (directory_arg != NULL) {
+        options.directory = argv[directory_arg];
+    }
+    std::filesystem::create_directories(options.directory);
+
+    std::mt19937_64 generator(0); // Same data in every run to compare versions
+    benchmarkChunks(options, generator);
+    benchmarkStreams(options, generator);
+    benchmarkArchive(options, generator);
+    return 0;
+}
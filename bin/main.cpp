@@ -1,40 +1,157 @@
 #include <lib/archive.h>
 #include <lib/arguments.h>
 #include <lib/error_codes.h>
+#include <lib/lz.h>
 #include <iostream>
 #include <cmath>
+#include <cstring>
+#include <filesystem>
 
 void invalidArguments() {
   std::cerr << "Invalid arguments\n";
   exit(ERROR_INVALID_PARARMETER);
 }
 
+uint16_t parseNumber(const char* argument) {
+    char* end;
+    unsigned long number = strtoul(argument, &end, 10);
+    if (*end != '\0' || end == argument || number == 0 || number > UINT16_MAX) {
+        invalidArguments();
+    }
+    return number;
+}
+
+// Chunk size in bytes or "auto", returns it in bits
+uint16_t parseChunkSize(const char* argument) {
+    if (strcmp(argument, "auto") == 0) {
+        return CorrectingArchive::AUTO_CHUNK_SIZE;
+    }
+    uint16_t chunk_size = parseNumber(argument);
+    if (chunk_size > CorrectingArchive::MAX_CHUNK_SIZE / BITS_IN_BYTE) {
+        invalidArguments();
+    }
+    return chunk_size * BITS_IN_BYTE;
+}
+
+uint8_t parseCompressionLevel(const char* argument) {
+    uint16_t level = parseNumber(argument);
+    if (level > LzCodec::MAX_LEVEL) {
+        invalidArguments();
+    }
+    return level;
+}
+
+double parseRate(const char* argument) {
+    char* end;
+    double rate = strtod(argument, &end);
+    if (*end != '\0' || end == argument || !(rate > 0 && rate < 1)) {
+        invalidArguments();
+    }
+    return rate;
+}
+
+// Files between stdin arguments are appended at once, directories are walked when recursive
+void appendInputs(CorrectingArchive& archive,
+                  char** argv,
+                  const std::vector<size_t>& inputs,
+                  const std::string& stream_name,
+                  uint16_t chunk_size,
+                  bool recursive) {
+    std::vector<InputFile> files;
+    for (auto input : inputs) {
+        std::string file_path = argv[input];
+        if (file_path == CorrectingArchive::STANDARD_STREAM) {
+            archive.appendFiles(files, chunk_size);
+            files.clear();
+            archive.appendStream(std::cin, stream_name, chunk_size);
+        } else {
+            archive.collectInputFiles(file_path, recursive, files);
+        }
+    }
+    archive.appendFiles(files, chunk_size);
+}
+
 int main(int argc, char** argv) {
     ArgumentParser ap = ArgumentParser(argc, argv);
     bool create = ap.parseBoolArgument("-c", "--create");
     bool list = ap.parseBoolArgument("-l", "--list");
     bool extract = ap.parseBoolArgument("-x", "--extract");
     bool append = ap.parseBoolArgument("-a", "--append");
+    bool remove = ap.parseBoolArgument("-d", "--delete");
+    bool vacuum = ap.parseBoolArgument("-V", "--vacuum");
+    bool concatenate = ap.parseBoolArgument("-A", "--concatenate");
+    bool verify = ap.parseBoolArgument("-v", "--verify");
+    bool repair = ap.parseBoolArgument("-R", "--repair");
+    bool stats = ap.parseBoolArgument("-S", "--stats");
+    bool json = ap.parseBoolArgument("-j", "--json");
+    bool mapped = ap.parseBoolArgument("-m", "--mmap");
+    bool recursive = ap.parseBoolArgument("-r", "--recursive");
+    bool systematic = ap.parseBoolArgument("-s", "--systematic");
+    bool dedup = ap.parseBoolArgument("-D", "--dedup");
     std::string archive_path = ap.parseArgumentByRegex("-f", std::regex("--file=.+"), true);
     if (archive_path[0] == '-') {
         archive_path = archive_path.substr(strlen("--file=")); // Separate archive_path path from flag
     }
     size_t extract_path_arg = ap.parseParameterizedArgument("-p", "--extract-path", 1, false);
+    size_t threads_arg = ap.parseParameterizedArgument("-t", "--threads", 1, false);
+    size_t name_arg = ap.parseParameterizedArgument("-n", "--name", 1, false);
+    size_t chunk_arg = ap.parseParameterizedArgument("-C", "--chunk", 1, false);
+    size_t error_rate_arg = ap.parseParameterizedArgument("-e", "--error-rate", 1, false);
+    size_t compress_arg = ap.parseParameterizedArgument("-z", "--compress", 1, false);
+    uint16_t chunk_size = chunk_arg != NULL ? parseChunkSize(argv[chunk_arg]) : HammingCode::BYTE_CHUNK_SIZE;
+    std::string stream_name = name_arg != NULL ? argv[name_arg] : "stdin";
 
     CorrectingArchive archive(archive_path);
+    if (threads_arg != NULL) {
+        archive.setThreadsAmount(parseNumber(argv[threads_arg]));
+    }
+    archive.setMappedReading(mapped);
+    archive.setSystematic(systematic);
+    archive.setDeduplication(dedup);
+    if (compress_arg != NULL) {
+        archive.setCompressionLevel(parseCompressionLevel(argv[compress_arg]));
+    }
+    if (error_rate_arg != NULL) {
+        archive.setErrorRate(parseRate(argv[error_rate_arg]));
+    }
+    int exit_code = 0;
     if (create) {
         archive.createEmptyArchive();
-        std::vector<size_t> files = ap.getRest();
-        for (auto file : files) {
-            std::string file_path = argv[file];
-            archive.appendFile(file_path, 8);
-        }
+        appendInputs(archive, argv, ap.getRest(), stream_name, chunk_size, recursive);
     } else if (append) {
+        appendInputs(archive, argv, ap.getRest(), stream_name, chunk_size, recursive);
+    } else if (remove) {
         std::vector<size_t> files = ap.getRest();
         for (auto file : files) {
-            std::string file_path = argv[file];
-            archive.appendFile(file_path, 8);
+            std::string file_name = argv[file];
+            archive.deleteFile(file_name);
+        }
+    } else if (concatenate) {
+        std::vector<size_t> sources = ap.getRest();
+        for (auto source : sources) {
+            std::error_code error;
+            if (std::filesystem::equivalent(argv[source], archive_path, error)) {
+                invalidArguments(); // Result would overwrite its source
+            }
         }
+        archive.createEmptyArchive();
+        for (auto source : sources) {
+            CorrectingArchive source_archive(argv[source]);
+            source_archive.setMappedReading(mapped);
+            archive.appendArchive(source_archive);
+        }
+    } else if (verify || repair) {
+        Verification report = repair ? archive.repair() : archive.verify();
+        if (json) {
+            report.printJson(std::cout);
+        } else {
+            report.printText(std::cout);
+        }
+        if (!report.isRecoverable()) {
+            exit_code = ERROR_INVALID_ARHIVE; // Statistics are still printed below
+        }
+    } else if (vacuum) {
+        archive.vacuum();
     } else if (list) {
         std::vector<std::string> files = archive.listFiles();
         for (auto file : files) {
@@ -57,5 +174,12 @@ int main(int argc, char** argv) {
             invalidArguments();
         }
     }
-    return 0;
+    if (stats) { // stdout may be taken by extracted files
+        if (json) {
+            archive.getStatistics().printJson(std::cerr);
+        } else {
+            archive.getStatistics().printText(std::cerr);
+        }
+    }
+    return exit_code;
 }
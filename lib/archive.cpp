@@ -1,19 +1,38 @@
 #include "archive.h"
+#include "comparing_buffer.h"
+#include "crc32c.h"
 #include "error_codes.h"
+#include "lz.h"
 #include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 
 CorrectingArchive::CorrectingArchive(std::string archive_path)
     : archive_path(archive_path) {
     archive = std::ofstream();
-    getNumberOfFiles();
+    readArchiveHeader();
 }
 
 CorrectingArchive::~CorrectingArchive() {
-    if (archive.is_open()) {
-        archive_stream.close();
-        setNumberOfFiles();
-        archive.close();
+    closeArchive();
+}
+
+// Finishes writing: stores the index and the number of files
+void CorrectingArchive::closeArchive() {
+    if (!archive.is_open()) {
+        return;
     }
+    archive_stream.close();
+    writeIndex();
+    writeArchiveHeader();
+    archive.close();
+    // Drop whatever was left after the new footer by the previous index
+    uint64_t archive_end = alignToByte(data_end) + getIndexSize() + FOOTER_SIZE;
+    std::filesystem::resize_file(archive_path, archive_end / BITS_IN_BYTE);
+    index_stored = true;
 }
 
 void CorrectingArchive::invalidArchive() {
@@ -28,7 +47,6 @@ void CorrectingArchive::invalidFile(const std::string& file_path) {
 
 uint8_t CorrectingArchive::getPaddingBitsAmount(uint64_t file_size, uint16_t chunk_size) {
     uint32_t encoded_chunk_size = HammingCode::getEncodedChunkSize(chunk_size);
-    chunk_size /= BITS_IN_BYTE;
     uint64_t chunk_amount = file_size / chunk_size + 1 * static_cast<bool>(file_size % chunk_size);
     uint8_t padding_bits_amount = (BITS_IN_BYTE - ((chunk_amount * encoded_chunk_size) % BITS_IN_BYTE)) % BITS_IN_BYTE;
     return padding_bits_amount;
@@ -40,29 +58,50 @@ void CorrectingArchive::createEmptyArchive() {
         invalidArchive();
     }
 
+    setFormatVersion(FORMAT_VERSION);
     files_number = 0;
-    bits header(EXTENDED_HEADER_SIZE); // Zero files in empty archive
+    index.clear();
+    index_loaded = true;
+    index_stored = false;
+    bits header(archive_header_size); // Written on close, when the number of files is known
     archive_stream.write(header);
-
-    archive_stream.close();
+    data_end = archive_header_size;
 }
 
-void CorrectingArchive::getNumberOfFiles() {
+// Archives without format magic are legacy ones, starting with the number of files
+void CorrectingArchive::readArchiveHeader() {
     if (!archiveExists()) {
+        setFormatVersion(FORMAT_VERSION);
         files_number = 0;
         return;
     }
 
-    // TODO: extract opening to read to function and add class field read_archive_stream
-    std::ifstream read_archive(archive_path, std::ios::in | std::ios::binary);
-    if (!read_archive.is_open()) {
-        invalidArchive();
-    }
+    ReadArchive read_archive;
+    openArchiveToRead(read_archive);
+    bitReader& read_stream = *read_archive.bit_stream;
 
-    bitReader read_stream(read_archive);
+    try {
+        bits magic;
+        if (readChunk(read_stream, OFFSET_INFO, OFFSET_CONTROL_BITS, magic)
+            && (fromBits<uint64_t>(magic) & Bits::lowBits(VERSION_SHIFT)) == ARCHIVE_MAGIC) {
+            uint8_t version = fromBits<uint64_t>(magic) >> VERSION_SHIFT;
+            if (version < FRAMED_VERSION || version > FORMAT_VERSION) {
+                invalidArchive();
+            }
+            setFormatVersion(version);
+            if (version >= COMPACT_VERSION) {
+                files_number = fromBits<uint64_t>(readChunk(read_stream, OFFSET_INFO, OFFSET_CONTROL_BITS));
+            } else {
+                files_number = fromBits<uint16_t>(readChunk(read_stream, HEADER_SIZE, FILES_NUMBER_CONTROL_BITS));
+            }
+            return;
+        }
+    } catch (const std::out_of_range&) { // Legacy archive may be shorter than the magic
+    }
 
+    setFormatVersion(LEGACY_VERSION);
+    read_stream.seek(0);
     bits header = read_stream.read(HEADER_SIZE);
-    read_archive.close();
 
     HammingCode::decodeChunk(header, FILES_NUMBER_CONTROL_BITS);
     uint16_t new_files_number = fromBits<uint16_t>(header);
@@ -70,128 +109,1554 @@ void CorrectingArchive::getNumberOfFiles() {
     files_number = new_files_number;
 }
 
-void CorrectingArchive::setNumberOfFiles() {
+void CorrectingArchive::setFormatVersion(uint8_t version) {
+    format_version = version;
+    bool framed = version >= FRAMED_VERSION;
+    archive_header_size = version >= COMPACT_VERSION ? COMPACT_HEADER_SIZE
+                                                     : framed ? FRAMED_HEADER_SIZE : EXTENDED_HEADER_SIZE;
+    file_header_size = framed ? FRAMED_FILE_HEADER_SIZE : LEGACY_FILE_HEADER_SIZE;
+}
+
+// Maps the archive to memory when mapped reading is enabled, falls back to stream reading otherwise
+void CorrectingArchive::openArchiveToRead(ReadArchive& read_archive) {
+    if (mapped_reading && read_archive.mapping.map(archive_path)) {
+        read_archive.bit_stream = std::make_unique<bitReader>(read_archive.mapping.getData(),
+                                                              read_archive.mapping.getSize());
+        return;
+    }
+    read_archive.stream.open(archive_path, std::ios::in | std::ios::binary);
+    if (!read_archive.stream.is_open()) {
+        invalidArchive();
+    }
+    read_archive.bit_stream = std::make_unique<bitReader>(read_archive.stream);
+}
+
+void CorrectingArchive::writeArchiveHeader() {
 //    archive.seekp(0); // Go to header
     archive_stream.close(); // Go to header
-    bits number = toBits(files_number);
-    HammingCode::encodeChunk(number);
-    archive_stream.write(number);
+    if (format_version >= FRAMED_VERSION) {
+        writeNumber(ARCHIVE_MAGIC | static_cast<uint64_t>(format_version) << VERSION_SHIFT);
+    }
+    if (format_version >= COMPACT_VERSION) {
+        writeNumber(files_number);
+    } else {
+        bits number = toBits(static_cast<uint16_t>(files_number));
+        HammingCode::encodeChunk(number);
+        archive_stream.write(number);
+    }
     archive_stream.close();
 }
 void CorrectingArchive::printBits(bits& bts, std::string message) {
-    for (auto bit : bts) {
-        std::cerr << bit;
+    for (size_t i = 0; i < bts.size(); i++) {
+        std::cerr << bts[i];
     }
     std::cerr << ' ' << message << '\n';
 }
 
 void CorrectingArchive::appendFile(std::string& file_path, uint16_t chunk_size) {
+    std::vector<InputFile> files;
+    collectInputFiles(file_path, false, files);
+    appendFiles(files, chunk_size);
+}
+
+/*
+    Files of a directory are sorted by path, so the archive doesn't depend on the file system.
+    Names start with the directory name, e.g. files of "a/b/" are stored as "b/...".
+    The archive itself is skipped when it's inside the directory
+*/
+void CorrectingArchive::collectInputFiles(const std::string& path,
+                                          bool recursive,
+                                          std::vector<InputFile>& files) const {
+    std::error_code error;
+    if (!recursive || !std::filesystem::is_directory(path, error)) {
+        files.push_back({path, path.substr(path.find_last_of("/\\") + 1)});
+        return;
+    }
+
+    std::filesystem::path root = std::filesystem::path(path).lexically_normal();
+    if (!root.has_filename()) { // Trailing separator
+        root = root.parent_path();
+    }
+    std::filesystem::path prefix = root.filename();
+    if (prefix == "." || prefix == "..") {
+        prefix.clear();
+    }
+    std::filesystem::path archive_file = std::filesystem::absolute(archive_path).lexically_normal();
+    size_t first_file = files.size();
+    std::filesystem::recursive_directory_iterator it(root, error);
+    for (; !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+        if (it->is_regular_file(error) && std::filesystem::absolute(it->path()).lexically_normal() != archive_file) {
+            files.push_back({it->path().string(), (prefix / it->path().lexically_relative(root)).generic_string()});
+        }
+    }
+    if (error) {
+        invalidFile(path);
+    }
+    std::sort(files.begin() + first_file, files.end(), [](const InputFile& a, const InputFile& b) {
+      return a.name < b.name;
+    });
+}
+
+/*
+    Blocks of all files are read and encoded on one thread pool, so many small files are encoded in parallel
+    as well as blocks of a large one. Encoded blocks are written in order, each file header before the first
+    block of its file, so the archive is the same as after appending the files one by one.
+    Every file is checked before anything is written, by batches on the pool, so syscalls of many small files
+    overlap as well as their reading.
+    Legacy file headers have no flags, so a legacy archive is vacuumed to the framed format before systematic files
+*/
+void CorrectingArchive::appendFiles(const std::vector<InputFile>& files, uint16_t chunk_size) {
+    if (files.empty()) {
+        return;
+    }
+    if (systematic && archiveExists() && format_version < FRAMED_VERSION) {
+        closeArchive();
+        vacuum();
+    }
+    ThreadPool pool(threads_amount > 1 ? threads_amount : 0);
+    std::vector<FileHeader> file_headers(files.size());
+    std::vector<std::future<size_t>> checked_batches; // Each returns its first unreadable file or files.size()
+    for (size_t first = 0; first < files.size(); first += HEADERS_BATCH_SIZE) {
+        size_t last = std::min(first + HEADERS_BATCH_SIZE, files.size());
+        checked_batches.push_back(pool.submit([&, first, last] {
+            for (size_t i = first; i < last; i++) {
+                if (!getFileHeader(files[i], chunk_size, file_headers[i])
+                    || (file_headers[i].flags & HASHED_FLAG && !hashFile(files[i].path, file_headers[i]))) {
+                    return i;
+                }
+            }
+            return files.size();
+        }));
+    }
+    for (auto& batch : checked_batches) {
+        size_t failed_file = batch.get();
+        if (failed_file < files.size()) {
+            invalidFile(files[failed_file].path);
+        }
+    }
     openArchiveToWrite();
-    struct FileHeader file_header = writeFileHeader(file_path, chunk_size);
+    OriginalFiles originals;
+    if (deduplication && format_version >= COMPACT_VERSION) {
+        originals = getOriginalFiles();
+    }
+    if (compression_level && format_version >= COMPACT_VERSION) {
+        // Compressed size is known only after the file was written, so it's appended like a stream
+        for (size_t i = 0; i < files.size(); i++) {
+            linkDuplicate(originals, file_headers[i], data_end, files[i].path);
+            if (isLinked(file_headers[i])) {
+                writeFileHeader(file_headers[i]);
+                addWrittenFile(file_headers[i], true);
+                continue;
+            }
+            std::ifstream file(files[i].path, std::ios::in | std::ios::binary);
+            if (!file.is_open()) {
+                invalidFile(files[i].path);
+            }
+            appendEncodedStream(file, file_headers[i]);
+        }
+        return;
+    }
+    uint64_t file_offset = data_end;
+    for (size_t i = 0; i < files.size(); i++) { // Sizes of other files are known, so are offsets of their headers
+        linkDuplicate(originals, file_headers[i], file_offset, files[i].path);
+        file_offset += getFileHeaderSize(file_headers[i]) + getEncodedFileLength(file_headers[i]);
+    }
 
-    std::ifstream file;
-    file.open(file_path, std::ios::in | std::ios::binary);
-    if (!file.is_open()) {
-        invalidFile(file_path);
+    size_t failed_file = files.size();
+    BackgroundWriter<EncodedBlock> writer(PENDING_BLOCKS_PER_THREAD * pool.size(), [&](EncodedBlock& block) {
+      BlockBuffers buffers = block.buffers.get();
+      const FileHeader& file_header = file_headers[block.file_number];
+      uint64_t file_size = file_header.file_size / BITS_IN_BYTE;
+      if (buffers.data.size() != std::min<uint64_t>(getBlockSize(file_header.chunk_size), file_size - block.offset)) {
+          failed_file = block.file_number; // File was changed or can't be read
+          return false;
+      }
+      auto start = Statistics::Clock::now();
+      if (!block.offset) {
+          writeFileHeader(file_header);
+      }
+      if (isSystematic(file_header)) {
+          archive_stream.writeBytes(buffers.data.data(), buffers.data.size());
+      }
+      archive_stream.write(buffers.encoded);
+      if (block.offset + buffers.data.size() == file_size) {
+          archive_stream.write(bits(file_header.padding));
+      }
+      Statistics::addTime(statistics.io_time, start);
+      block_buffers.release(std::move(buffers));
+      return true;
+    });
+
+    bool writing = true;
+    for (size_t i = 0; i < files.size() && writing; i++) {
+        const FileHeader& file_header = file_headers[i];
+        size_t block_size = getBlockSize(file_header.chunk_size);
+        uint64_t file_size = file_header.file_size / BITS_IN_BYTE;
+        uint64_t offset = 0;
+        do { // Empty files still get an empty block to write their header
+            size_t read_size = std::min<uint64_t>(block_size, file_size - offset);
+            std::future<BlockBuffers> buffers = pool.submit(
+                [this, &file_path = files[i].path, offset, read_size, chunk_size = file_header.chunk_size,
+                    systematic_file = isSystematic(file_header)] {
+                  BlockBuffers buffers = block_buffers.acquire();
+                  auto start = Statistics::Clock::now();
+                  std::ifstream file(file_path, std::ios::in | std::ios::binary);
+                  file.seekg(static_cast<std::streamoff>(offset));
+                  readBlock(file, buffers.data, read_size);
+                  statistics.bytes_read += buffers.data.size();
+                  Statistics::addTime(statistics.io_time, start);
+                  start = Statistics::Clock::now();
+                  encodeBlock(buffers, chunk_size, systematic_file);
+                  Statistics::addTime(statistics.coding_time, start);
+                  return buffers;
+                });
+            writing = writer.push({i, offset, std::move(buffers)});
+            offset += read_size;
+        } while (offset < file_size && writing);
     }
-    bitReader file_stream(file);
-    bits chunk;
-    while (!file_stream.eof()) {
-        chunk = file_stream.read(chunk_size);
-        HammingCode::encodeChunk(chunk);
-        archive_stream.write(chunk);
+    if (!writer.finish()) {
+        invalidFile(files[failed_file].path);
     }
-    file.close();
 
-    archive_stream.write(bits(file_header.padding));
+    for (auto& file_header : file_headers) {
+        addWrittenFile(file_header, true);
+    }
+}
 
+void CorrectingArchive::addWrittenFile(const FileHeader& file_header, bool encoded) {
+    countWrittenFile(file_header, encoded);
+    index.push_back({data_end, file_header});
+    data_end += getFileHeaderSize(file_header) + getEncodedFileLength(file_header);
     files_number++;
 }
 
-std::vector<std::string> CorrectingArchive::listFiles() {
-    getNumberOfFiles();
-    // TODO: extract opening to read to function and add class field read_archive_stream
-    std::ifstream read_archive(archive_path, std::ios::in | std::ios::binary);
-    if (!read_archive.is_open()) {
+void CorrectingArchive::countWrittenFile(const FileHeader& file_header, bool encoded) {
+    uint64_t chunk_amount = getChunkAmount(file_header);
+    uint64_t record_size = (getFileHeaderSize(file_header) + getEncodedFileLength(file_header)) / BITS_IN_BYTE;
+    if (encoded) {
+        statistics.codewords_encoded += chunk_amount;
+    } else {
+        statistics.bytes_read += record_size;
+    }
+    statistics.bytes_written += record_size;
+    statistics.files.push_back({file_header.file_name, getRawSize(file_header), chunk_amount, 0});
+}
+
+/*
+    Decodes every header and data codeword without writing anything, damaged codewords are reported
+    instead of stopping. Data blocks are checked on the thread pool like they are decoded by extraction
+*/
+Verification CorrectingArchive::verify() {
+    return scrub(false);
+}
+
+/*
+    Checks the archive like verify and writes every corrected error back to it.
+    Only the byte holding the wrong bit is rewritten, so healthy parts of the archive aren't touched
+*/
+Verification CorrectingArchive::repair() {
+    return scrub(true);
+}
+
+Verification CorrectingArchive::scrub(bool repair) {
+    Verification report;
+    ReadArchive read_archive;
+    openArchiveToRead(read_archive);
+    bitReader& read_stream = *read_archive.bit_stream;
+    bool framed = format_version >= FRAMED_VERSION;
+    if (framed && !read_archive.mapping.isMapped() && !read_archive.file.open(archive_path)) {
+        invalidArchive();
+    }
+    PositionedFile repaired_file;
+    if (repair && !repaired_file.open(archive_path, true)) {
+        invalidArchive();
+    }
+
+    // Blocks are repaired by the main thread after they were checked, so no block is read while it's patched
+    auto fixErrors = [&](const CheckedBlock& block) {
+        if (!repair) {
+            return;
+        }
+        for (uint64_t pos : block.errors) {
+            flipBit(repaired_file, pos);
+        }
+        report.repaired += block.errors.size();
+    };
+
+    std::vector<uint32_t> header_fields = {format_version >= COMPACT_VERSION ? OFFSET_INFO : HEADER_SIZE};
+    if (framed) {
+        header_fields.insert(header_fields.begin(), OFFSET_INFO);
+    }
+    CheckedBlock archive_header = checkFields(read_stream, 0, header_fields);
+    report.header_corrected = archive_header.corrected;
+    report.header_damaged = archive_header.damaged_amount;
+    fixErrors(archive_header);
+
+    index_stored = readIndex();
+    report.index_valid = index_stored;
+    report.complete = index_stored || scanIndex();
+    index_loaded = report.complete;
+    if (index_stored) {
+        CheckedBlock stored_index = checkIndex(read_stream);
+        report.index_corrected = stored_index.corrected;
+        fixErrors(stored_index);
+    }
+
+    ThreadPool pool(threads_amount > 1 ? threads_amount : 0);
+    std::deque<std::pair<size_t, std::future<CheckedBlock>>> checked_blocks; // Entry number and its block
+
+    auto addBlock = [&]() {
+        auto& [entry_number, checked_block] = checked_blocks.front();
+        CheckedBlock block = checked_block.get();
+        FileVerification& file = report.files[entry_number];
+        file.corrected += block.corrected;
+        file.damaged_amount += block.damaged_amount;
+        for (uint64_t offset : block.damaged) {
+            if (file.damaged.size() < Verification::MAX_REPORTED_DAMAGE) {
+                file.damaged.push_back(offset);
+            }
+        }
+        fixErrors(block);
+        checked_blocks.pop_front();
+    };
+
+    for (size_t i = 0; i < index.size(); i++) {
+        const FileHeader& file_header = index[i].file_header;
+        FileVerification file;
+        file.file_name = file_header.file_name;
+        file.offset = index[i].offset;
+        file.deleted = file_header.flags & DELETED_FLAG;
+        file.codewords = getChunkAmount(file_header);
+        CheckedBlock checked_header = checkFields(read_stream, index[i].offset, getFileHeaderFields(file_header));
+        file.header_corrected = checked_header.corrected;
+        file.header_damaged = checked_header.damaged_amount;
+        fixErrors(checked_header);
+        report.files.push_back(file);
+
+        uint32_t encoded_chunk_size = HammingCode::getEncodedChunkSize(file_header.chunk_size);
+        uint64_t block_bits = getBlockSize(file_header.chunk_size) * BITS_IN_BYTE;
+        uint64_t file_length = file_header.file_size;
+        uint64_t block_offset = index[i].offset + getFileHeaderSize(file_header);
+        while (file_length) {
+            uint64_t decoded_bits = std::min(file_length, block_bits);
+            uint64_t chunk_amount = (decoded_bits + file_header.chunk_size - 1) / file_header.chunk_size;
+            uint64_t encoded_bits = getEncodedBlockSize(file_header, decoded_bits);
+            if (isSystematic(file_header)) {
+                checked_blocks.emplace_back(i, pool.submit(
+                    [this, &read_archive, block_offset, decoded_bits, encoded_bits, chunk_amount,
+                        chunk_size = file_header.chunk_size] {
+                      BlockBuffers buffers;
+                      if (!readSystematicBlock(read_archive, block_offset / BITS_IN_BYTE, decoded_bits / BITS_IN_BYTE,
+                                               encoded_bits - decoded_bits, buffers)) {
+                          return unreadableBlock(block_offset, chunk_amount, chunk_size);
+                      }
+                      return checkSystematicBlock(buffers, block_offset, chunk_size);
+                    }));
+            } else if (framed) {
+                checked_blocks.emplace_back(i, pool.submit(
+                    [&read_archive, block_offset, encoded_bits, chunk_amount, encoded_chunk_size,
+                        chunk_size = file_header.chunk_size] {
+                      bits encoded_block;
+                      std::vector<unsigned char> bytes;
+                      if (!readFrames(read_archive, block_offset / BITS_IN_BYTE, encoded_bits, encoded_block, bytes)) {
+                          return unreadableBlock(block_offset, chunk_amount, encoded_chunk_size);
+                      }
+                      return checkBlock(encoded_block, block_offset, chunk_size);
+                    }));
+            } else {
+                bits encoded_block;
+                try {
+                    read_stream.seek(block_offset);
+                    read_stream.read(encoded_block, encoded_bits);
+                } catch (const std::out_of_range&) {
+                    encoded_block.clear();
+                }
+                checked_blocks.emplace_back(i, pool.submit(
+                    [encoded_block = std::move(encoded_block), block_offset, encoded_bits, chunk_amount,
+                        encoded_chunk_size, chunk_size = file_header.chunk_size] {
+                      if (encoded_block.size() != encoded_bits) {
+                          return unreadableBlock(block_offset, chunk_amount, encoded_chunk_size);
+                      }
+                      return checkBlock(encoded_block, block_offset, chunk_size);
+                    }));
+            }
+            if (checked_blocks.size() >= PENDING_BLOCKS_PER_THREAD * pool.size()) {
+                addBlock();
+            }
+            file_length -= decoded_bits;
+            block_offset += encoded_bits;
+        }
+    }
+    while (!checked_blocks.empty()) {
+        addBlock();
+    }
+    return report;
+}
+
+// Valid blocks of bytes are decoded with tables, others are searched for errors codeword by codeword
+CorrectingArchive::CheckedBlock CorrectingArchive::checkBlock(const bits& encoded_block,
+                                                              uint64_t block_offset,
+                                                              uint16_t chunk_size) {
+    CheckedBlock block;
+    uint64_t corrected = 0;
+    if (chunk_size == HammingCode::BYTE_CHUNK_SIZE) {
+        std::vector<unsigned char> data(encoded_block.size() / HammingCode::BITS_IN_ENCODED_BYTE);
+        if (HammingCode::decodeBytes(encoded_block, data.data(), corrected) && !corrected) {
+            return block;
+        }
+    } else {
+        bits decoded;
+        if (HammingCode::decodeChunks(encoded_block, chunk_size, decoded, corrected) && !corrected) {
+            return block;
+        }
+    }
+    checkCodewords(encoded_block, HammingCode::getEncodedChunkSize(chunk_size), block_offset, block);
+    return block;
+}
+
+// Codewords of the same size are checked one by one, their positions are counted from offset
+void CorrectingArchive::checkCodewords(bitView encoded,
+                                       uint32_t encoded_chunk_size,
+                                       uint64_t offset,
+                                       CheckedBlock& block) {
+    for (size_t pos = 0; pos + encoded_chunk_size <= encoded.size(); pos += encoded_chunk_size) {
+        uint32_t error_pos = HammingCode::getErrorPosition(encoded.view(pos, encoded_chunk_size));
+        if (!error_pos) {
+            continue;
+        }
+        if (error_pos > encoded_chunk_size) {
+            block.addDamage(offset + pos);
+        } else {
+            block.corrected++;
+            block.errors.push_back(offset + pos + error_pos - 1);
+        }
+    }
+}
+
+void CorrectingArchive::CheckedBlock::addDamage(uint64_t pos) {
+    damaged_amount++;
+    if (damaged.size() < Verification::MAX_REPORTED_DAMAGE) {
+        damaged.push_back(pos);
+    }
+}
+
+void CorrectingArchive::CheckedBlock::add(const CheckedBlock& other) {
+    corrected += other.corrected;
+    for (uint64_t pos : other.damaged) {
+        addDamage(pos);
+    }
+    damaged_amount += other.damaged_amount - other.damaged.size();
+    errors.insert(errors.end(), other.errors.begin(), other.errors.end());
+}
+
+/*
+    Codewords are rebuilt from data and control bits and checked like in other blocks, positions of errors
+    are mapped back to the bits stored in the archive. Several errors in a codeword may look like a single one
+    or none, so the data is compared with the checksum too
+*/
+CorrectingArchive::CheckedBlock CorrectingArchive::checkSystematicBlock(BlockBuffers& buffers,
+                                                                        uint64_t block_offset,
+                                                                        uint16_t chunk_size) const {
+    CheckedBlock block;
+    uint64_t data_bits = buffers.data.size() * BITS_IN_BYTE;
+    if (!data_bits) {
+        return block;
+    }
+    uint32_t encoded_chunk_size = HammingCode::getEncodedChunkSize(chunk_size);
+    uint8_t control_bits_amount = HammingCode::getControlBitsAmount(chunk_size);
+    uint64_t parity_bits = (data_bits + chunk_size - 1) / chunk_size * control_bits_amount;
+    uint64_t parity_offset = block_offset + data_bits;
+    buffers.scratch.clear();
+    buffers.scratch.appendBytes(buffers.data.data(), buffers.data.size());
+    HammingCode::buildCodewords(buffers.scratch, buffers.encoded.view(0, parity_bits), chunk_size, buffers.codewords);
+
+    CheckedBlock codewords;
+    checkCodewords(buffers.codewords, encoded_chunk_size, 0, codewords);
+    for (uint64_t pos : codewords.damaged) {
+        block.addDamage(block_offset + pos / encoded_chunk_size * chunk_size);
+    }
+    block.damaged_amount += codewords.damaged_amount - codewords.damaged.size();
+    for (uint64_t pos : codewords.errors) {
+        uint64_t chunk = pos / encoded_chunk_size;
+        uint32_t position = pos % encoded_chunk_size + 1;
+        uint64_t data_pos = chunk * chunk_size + position - 1 - std::bit_width(position);
+        if (std::has_single_bit(position)) {
+            block.errors.push_back(parity_offset + chunk * control_bits_amount + std::countr_zero(position));
+        } else if (data_pos < data_bits) {
+            block.errors.push_back(block_offset + data_pos);
+        } else { // Error in the zero padding of the last chunk, which isn't stored
+            block.addDamage(block_offset + chunk * chunk_size);
+            continue;
+        }
+        block.corrected++;
+    }
+    checkCodewords(buffers.encoded.view(parity_bits, CHECKSUM_INFO), CHECKSUM_INFO, parity_offset + parity_bits, block);
+
+    bits checksum = buffers.encoded.view(parity_bits, CHECKSUM_INFO);
+    bool checksum_corrected = false;
+    if (block.damaged_amount || !HammingCode::decodeChunk(checksum, CHECKSUM_CONTROL_BITS, checksum_corrected)) {
+        return block;
+    }
+    uint64_t corrected = 0;
+    buffers.scratch.clear();
+    HammingCode::decodeChunks(buffers.codewords, chunk_size, buffers.scratch, corrected);
+    buffers.scratch.resize(data_bits);
+    buffers.read.resize(buffers.data.size());
+    buffers.scratch.toBytes(buffers.read.data());
+    if (crc32c(buffers.read.data(), buffers.read.size()) != fromBits<uint32_t>(checksum)) {
+        block.addDamage(block_offset);
+    }
+    return block;
+}
+
+// Block which can't be read, e.g. cut off by the archive end, has every codeword damaged
+CorrectingArchive::CheckedBlock CorrectingArchive::unreadableBlock(uint64_t block_offset,
+                                                                   uint64_t chunk_amount,
+                                                                   uint32_t chunk_step) {
+    CheckedBlock block;
+    for (uint64_t chunk = 0; chunk < chunk_amount; chunk++) {
+        block.addDamage(block_offset + chunk * chunk_step);
+    }
+    return block;
+}
+
+// Checks consecutive codewords of given sizes, the ones cut off by the archive end are damaged
+CorrectingArchive::CheckedBlock CorrectingArchive::checkFields(bitReader& read_stream,
+                                                               uint64_t offset,
+                                                               const std::vector<uint32_t>& fields) {
+    CheckedBlock block;
+    bits field;
+    for (uint32_t field_size : fields) {
+        try {
+            read_stream.seek(offset);
+            field.clear();
+            read_stream.read(field, field_size);
+            checkCodewords(field, field_size, offset, block);
+        } catch (const std::out_of_range&) {
+            block.addDamage(offset);
+        }
+        offset += field_size;
+    }
+    return block;
+}
+
+/*
+    Sizes of codewords of a file header. Compact headers have a codeword of fields followed by the name chunks,
+    in older ones each file name byte is a codeword of its own
+*/
+std::vector<uint32_t> CorrectingArchive::getFileHeaderFields(const FileHeader& file_header) const {
+    if (format_version >= COMPACT_VERSION) {
+        std::vector<uint32_t> fields = {COMPACT_FIELDS_INFO};
+        fields.insert(fields.end(), getNumberFieldsAmount(file_header), FILE_SIZE_INFO);
+        size_t name_bits = file_header.file_name.size() * BITS_IN_BYTE;
+        fields.insert(fields.end(), (name_bits + NAME_CHUNK_SIZE - 1) / NAME_CHUNK_SIZE,
+                      HammingCode::getEncodedChunkSize(NAME_CHUNK_SIZE));
+        return fields;
+    }
+    std::vector<uint32_t> fields = {CHUNK_SIZE_INFO, FILE_SIZE_INFO, PADDING_INFO};
+    if (format_version >= FRAMED_VERSION) {
+        fields.push_back(FLAGS_INFO);
+    }
+    fields.insert(fields.end(), FILE_NAME_BITS / BITS_IN_BYTE, HammingCode::BITS_IN_ENCODED_BYTE);
+    return fields;
+}
+
+// Checks index entries and the footer of an index which was read
+CorrectingArchive::CheckedBlock CorrectingArchive::checkIndex(bitReader& read_stream) const {
+    CheckedBlock block;
+    uint64_t entry_offset = alignToByte(data_end);
+    for (auto& entry : index) {
+        std::vector<uint32_t> entry_fields = getFileHeaderFields(entry.file_header);
+        entry_fields.insert(entry_fields.begin(), OFFSET_INFO);
+        block.add(checkFields(read_stream, entry_offset, entry_fields));
+        entry_offset += OFFSET_INFO + getFileHeaderSize(entry.file_header);
+    }
+    uint64_t footer_start = alignToByte(data_end) + getIndexSize();
+    block.add(checkFields(read_stream, footer_start, {OFFSET_INFO, OFFSET_INFO, OFFSET_INFO}));
+    return block;
+}
+
+// Rewrites the byte holding bit at offset with the bit inverted
+void CorrectingArchive::flipBit(PositionedFile& file, uint64_t offset) {
+    unsigned char byte;
+    if (file.readAt(offset / BITS_IN_BYTE, &byte, 1) != 1) {
+        invalidArchive();
+    }
+    bits patched;
+    patched.appendBytes(&byte, 1);
+    patched.flip(offset % BITS_IN_BYTE);
+    patched.toBytes(&byte);
+    if (!file.writeAt(offset / BITS_IN_BYTE, &byte, 1)) {
+        invalidArchive();
+    }
+}
+
+/*
+    Marks the file deleted in its header and in the index, data stays in place until vacuum.
+    Legacy file headers have no flags, so a legacy archive is vacuumed to the current format first.
+    Flags of compact headers share a codeword with other fields, so the whole codeword is rewritten
+*/
+void CorrectingArchive::deleteFile(std::string& file_name) {
+    loadIndex();
+    if (format_version < FRAMED_VERSION) {
+        vacuum();
+        loadIndex();
+    }
+
+    PositionedFile file;
+    if (!file.open(archive_path, true)) {
+        invalidArchive();
+    }
+    bool deleted = false;
+    uint64_t entry_offset = alignToByte(data_end);
+    for (auto& entry : index) {
+        FileHeader& file_header = entry.file_header;
+        uint64_t next_entry_offset = entry_offset + OFFSET_INFO + getFileHeaderSize(file_header);
+        if (file_header.file_name != file_name || file_header.flags & DELETED_FLAG) {
+            entry_offset = next_entry_offset;
+            continue;
+        }
+        file_header.flags |= DELETED_FLAG;
+        bits flags_block;
+        uint64_t flags_offset = 0;
+        if (format_version >= COMPACT_VERSION) {
+            flags_block = encodeCompactFields(file_header);
+        } else {
+            flags_block = toBits(file_header.flags);
+            HammingCode::encodeChunk(flags_block);
+            flags_offset = FLAGS_OFFSET;
+        }
+        patchBits(file, entry.offset + flags_offset, flags_block);
+        if (index_stored) {
+            patchBits(file, entry_offset + OFFSET_INFO + flags_offset, flags_block);
+        }
+        entry_offset = next_entry_offset;
+        deleted = true;
+    }
+    if (!deleted) {
+        invalidFile(file_name);
+    }
+}
+
+// Overwrites bits of the archive in place, bytes partially covered by them are read and written back
+void CorrectingArchive::patchBits(PositionedFile& file, uint64_t offset, bitView value) {
+    uint64_t first_byte = offset / BITS_IN_BYTE;
+    std::vector<unsigned char> bytes((alignToByte(offset + value.size()) - first_byte * BITS_IN_BYTE) / BITS_IN_BYTE);
+    if (file.readAt(first_byte, bytes.data(), bytes.size()) != bytes.size()) {
+        invalidArchive();
+    }
+    bits patched;
+    patched.appendBytes(bytes.data(), bytes.size());
+    patched.copy(offset % BITS_IN_BYTE, value);
+    patched.toBytes(bytes.data());
+    if (!file.writeAt(first_byte, bytes.data(), bytes.size())) {
         invalidArchive();
     }
+}
 
-    bitReader read_stream(read_archive);
+// Copies files which aren't deleted to a new framed archive and replaces the archive with it
+void CorrectingArchive::vacuum() {
+    loadIndex();
+    std::string compacted_path = archive_path + ".vacuum";
+    std::filesystem::remove(compacted_path);
+    {
+        CorrectingArchive compacted(compacted_path);
+        compacted.createEmptyArchive();
+        compacted.copyFiles(*this);
+        statistics.add(compacted.statistics);
+    } // Compacted archive gets its index and header on destruction
+    std::filesystem::rename(compacted_path, archive_path);
+
+    readArchiveHeader();
+    index_loaded = false;
+}
+
+/*
+    Only file headers of source are decoded, encoded data is copied by whole bytes when it's byte-aligned,
+    so merging framed archives is bound by I/O
+*/
+void CorrectingArchive::appendArchive(CorrectingArchive& source) {
+    if (!source.archiveExists()) {
+        invalidFile(source.archive_path);
+    }
+    copyFiles(source);
+}
+
+// Copies files of source which aren't deleted after the last file
+void CorrectingArchive::copyFiles(CorrectingArchive& source) {
+    source.loadIndex();
+    uint8_t required_version = LEGACY_VERSION; // Oldest format able to keep flags of the copied files
+    for (auto& entry : source.index) {
+        if (!(entry.file_header.flags & DELETED_FLAG)) {
+            if (isCompressed(entry.file_header) || entry.file_header.flags & HASHED_FLAG) {
+                required_version = COMPACT_VERSION;
+            } else if (isSystematic(entry.file_header)) {
+                required_version = std::max(required_version, FRAMED_VERSION);
+            }
+        }
+    }
+    if (archiveExists() && format_version < required_version) {
+        closeArchive();
+        vacuum();
+    }
+    openArchiveToWrite();
+    ReadArchive read_archive;
+    source.openArchiveToRead(read_archive);
+    if (!read_archive.mapping.isMapped() && !read_archive.file.open(source.archive_path)) {
+        invalidArchive();
+    }
+    std::map<uint64_t, uint64_t> copied; // Header offsets of copied files in source and here
+    try {
+        for (auto& entry : source.index) {
+            if (entry.file_header.flags & DELETED_FLAG) {
+                continue;
+            }
+            const IndexEntry& original = source.resolveLink(entry);
+            auto copy = copied.find(original.offset);
+            if (copy != copied.end()) {
+                FileHeader link = entry.file_header;
+                link.link = copy->second;
+                writeFileHeader(link);
+                addWrittenFile(link, false);
+                continue;
+            }
+            // Data of a link which original was deleted is copied under the link's name
+            IndexEntry copied_entry = original;
+            copied_entry.file_header.file_name = entry.file_header.file_name;
+            copied_entry.file_header.flags &= ~DELETED_FLAG;
+            copied[original.offset] = data_end;
+            copyEntry(read_archive, copied_entry, original.offset + source.getFileHeaderSize(original.file_header));
+        }
+    } catch (const std::out_of_range&) { // Damaged header points past the archive end
+        invalidArchive();
+    }
+}
+
+// Writes a new header for the entry and copies its encoded chunks as they are
+void CorrectingArchive::copyEntry(ReadArchive& source, const IndexEntry& entry, uint64_t data_offset) {
+    FileHeader file_header = entry.file_header;
+    file_header.file_name.resize(std::min(file_header.file_name.size(), getMaxFileNameLength()));
+    file_header.padding = isSystematic(file_header) ? 0 : getPaddingBitsAmount(file_header.file_size,
+                                                                                 file_header.chunk_size);
+    writeFileHeader(file_header);
+    auto start = Statistics::Clock::now();
+    copyData(source, data_offset, getEncodedFileLength(file_header) - file_header.padding);
+    archive_stream.write(bits(file_header.padding));
+    Statistics::addTime(statistics.io_time, start);
 
-    read_stream.skip(EXTENDED_HEADER_SIZE);
+    addWrittenFile(file_header, false);
+}
+
+// Data starting on a byte boundary is copied by whole bytes, otherwise it goes through the bit reader
+void CorrectingArchive::copyData(ReadArchive& source, uint64_t offset, uint64_t bits_amount) {
+    if (offset % BITS_IN_BYTE == 0) {
+        uint64_t bytes_offset = offset / BITS_IN_BYTE;
+        uint64_t bytes_amount = bits_amount / BITS_IN_BYTE;
+        if (source.mapping.isMapped()) {
+            if (bytes_offset + bytes_amount > source.mapping.getSize()) {
+                invalidArchive();
+            }
+            archive_stream.writeBytes(source.mapping.getData() + bytes_offset, bytes_amount);
+        } else {
+            std::vector<unsigned char> block(std::min<uint64_t>(bytes_amount, BYTES_BLOCK_SIZE));
+            for (uint64_t copied = 0; copied < bytes_amount; copied += block.size()) {
+                size_t block_size = std::min<uint64_t>(bytes_amount - copied, block.size());
+                if (source.file.readAt(bytes_offset + copied, block.data(), block_size) != block_size) {
+                    invalidArchive();
+                }
+                archive_stream.writeBytes(block.data(), block_size);
+            }
+        }
+        offset += bytes_amount * BITS_IN_BYTE;
+        bits_amount -= bytes_amount * BITS_IN_BYTE;
+    }
+
+    bitReader& read_stream = *source.bit_stream;
+    read_stream.seek(offset);
+    bits block;
+    while (bits_amount) {
+        uint64_t block_bits = std::min<uint64_t>(bits_amount, BYTES_BLOCK_SIZE * BITS_IN_BYTE);
+        block.clear();
+        read_stream.read(block, block_bits);
+        archive_stream.write(block);
+        bits_amount -= block_bits;
+    }
+}
+
+/*
+    Size of the stream is unknown until it ends, so the file header is written with zero size
+    and rewritten in place afterwards. Only headers of framed archives start on a byte boundary,
+    a legacy archive is vacuumed to the framed format first
+*/
+void CorrectingArchive::appendStream(std::istream& stream, const std::string& file_name, uint16_t chunk_size) {
+    if (archiveExists() && format_version < FRAMED_VERSION) {
+        closeArchive();
+        vacuum();
+    }
+    openArchiveToWrite();
+    if (chunk_size == AUTO_CHUNK_SIZE) { // Size of a stream is known only after it was written
+        chunk_size = chooseChunkSize(STREAM_SIZE_ESTIMATE);
+    }
+
+    struct FileHeader file_header;
+    file_header.chunk_size = chunk_size;
+    file_header.file_size = 0;
+    file_header.padding = 0;
+    file_header.flags = systematic ? SYSTEMATIC_FLAG : 0;
+    if (compression_level && format_version >= COMPACT_VERSION) {
+        file_header.flags |= COMPRESSED_FLAG;
+    }
+    file_header.file_name = file_name.substr(0, getMaxFileNameLength());
+    appendEncodedStream(stream, file_header);
+}
+
+// Writes the file header with sizes of the written data once the stream ends, see appendStream
+void CorrectingArchive::appendEncodedStream(std::istream& stream, FileHeader& file_header) {
+    uint64_t header_offset = data_end;
+    writeFileHeader(file_header);
+
+    writeEncodedFile(stream, file_header);
+    file_header.padding = isSystematic(file_header) ? 0 : getPaddingBitsAmount(file_header.file_size,
+                                                                                 file_header.chunk_size);
+    archive_stream.write(bits(file_header.padding));
+
+    archive_stream.flush();
+    std::streampos end = archive.tellp();
+    archive.seekp(static_cast<std::streamoff>(header_offset / BITS_IN_BYTE));
+    writeFileHeader(file_header);
+    archive_stream.flush();
+    archive.seekp(end);
+
+    addWrittenFile(file_header, true);
+}
+
+std::vector<std::string> CorrectingArchive::listFiles() {
+    loadIndex();
     std::vector<std::string> files;
-    for (uint16_t i = 0; i < files_number; i++) {
-        struct FileHeader file_header = readFileHeader(read_stream);
-        files.push_back(file_header.file_name);
-        nextFile(file_header, read_stream);
+    for (auto& entry : index) {
+        if (!(entry.file_header.flags & DELETED_FLAG)) {
+            files.push_back(entry.file_header.file_name);
+        }
     }
     return files;
 }
 
-void CorrectingArchive::extractFile(bitReader& read_stream, struct FileHeader file_header, std::string& path) {
-    std::ofstream file;
-    file.open(path + '/' + file_header.file_name, std::ios::in | std::ios::trunc | std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "Invalid path\n";
-        exit(4);
+/*
+    Reads the file by blocks of whole chunks and encodes them on the thread pool.
+    Encoded blocks are written in the reading order, so the result doesn't depend on threads amount.
+    Input is read ahead and encoded blocks are written on their own threads, so reading, encoding and
+    writing of consecutive blocks overlap. Buffers of written blocks are reused for the next ones.
+    Blocks of a compressed file are compressed on the pool too, their frames are joined in order
+    and split into blocks again to be encoded. Sets sizes of file_header to the amounts written and read
+*/
+void CorrectingArchive::writeEncodedFile(std::istream& file, FileHeader& file_header) {
+    uint16_t chunk_size = file_header.chunk_size;
+    bool systematic_file = isSystematic(file_header);
+    size_t block_size = getBlockSize(chunk_size);
+    ThreadPool pool(threads_amount > 1 ? threads_amount : 0);
+    BackgroundWriter<std::future<BlockBuffers>> writer(PENDING_BLOCKS_PER_THREAD * pool.size(),
+                                                       [this, systematic_file](std::future<BlockBuffers>& encoded_block) {
+                                                         BlockBuffers buffers = encoded_block.get();
+                                                         auto start = Statistics::Clock::now();
+                                                         if (systematic_file) {
+                                                             archive_stream.writeBytes(buffers.data.data(),
+                                                                                       buffers.data.size());
+                                                         }
+                                                         archive_stream.write(buffers.encoded);
+                                                         Statistics::addTime(statistics.io_time, start);
+                                                         block_buffers.release(std::move(buffers));
+                                                         return true;
+                                                       });
+    BackgroundReader<BlockBuffers> reader(READ_AHEAD_BLOCKS, [&](BlockBuffers& buffers) {
+      buffers = block_buffers.acquire();
+      auto start = Statistics::Clock::now();
+      bool read = readBlock(file, buffers.data, block_size);
+      Statistics::addTime(statistics.io_time, start);
+      if (!read) {
+          block_buffers.release(std::move(buffers));
+      }
+      return read;
+    });
+
+    file_header.file_size = 0;
+    auto encode = [&](BlockBuffers buffers) {
+      file_header.file_size += buffers.data.size() * BITS_IN_BYTE;
+      writer.push(pool.submit([this, buffers = std::move(buffers), chunk_size, systematic_file]() mutable {
+          auto start = Statistics::Clock::now();
+          encodeBlock(buffers, chunk_size, systematic_file);
+          Statistics::addTime(statistics.coding_time, start);
+          return std::move(buffers);
+      }));
+    };
+
+    std::deque<std::future<BlockBuffers>> compressed_blocks;
+    BlockBuffers frames = block_buffers.acquire(); // Frames not encoded yet, less than a block
+    frames.data.clear();
+    auto joinFrames = [&] {
+      BlockBuffers buffers = compressed_blocks.front().get();
+      compressed_blocks.pop_front();
+      frames.data.insert(frames.data.end(), buffers.packed.begin(), buffers.packed.end());
+      block_buffers.release(std::move(buffers));
+      while (frames.data.size() >= block_size) {
+          BlockBuffers rest = block_buffers.acquire();
+          rest.data.assign(frames.data.begin() + block_size, frames.data.end());
+          frames.data.resize(block_size);
+          encode(std::move(frames));
+          frames = std::move(rest);
+      }
+    };
+
+    BlockBuffers buffers;
+    uint64_t read_amount = 0;
+    while (reader.pop(buffers)) {
+        read_amount += buffers.data.size();
+        if (!isCompressed(file_header)) {
+            encode(std::move(buffers));
+            continue;
+        }
+        compressed_blocks.push_back(pool.submit([this, buffers = std::move(buffers)]() mutable {
+            auto start = Statistics::Clock::now();
+            compressBlock(buffers);
+            Statistics::addTime(statistics.coding_time, start);
+            return std::move(buffers);
+        }));
+        if (compressed_blocks.size() > PENDING_BLOCKS_PER_THREAD * std::max<size_t>(pool.size(), 1)) {
+            joinFrames();
+        }
     }
-    bitWriter file_stream(file);
-    uint64_t file_length = getEncodedFileLength(file_header) - file_header.padding;
-    uint32_t encoded_chunk_size = HammingCode::getEncodedChunkSize(file_header.chunk_size);
-    bits chunk;
-    while (file_length) {
-        chunk = readChunk(read_stream,
-                          encoded_chunk_size,
-                          HammingCode::getControlBitsAmount(file_header.chunk_size));
-        file_length -= encoded_chunk_size;
-        file_stream.write(chunk);
+    while (!compressed_blocks.empty()) {
+        joinFrames();
+    }
+    if (!frames.data.empty()) {
+        encode(std::move(frames));
+    }
+    writer.finish();
+    statistics.bytes_read += read_amount;
+    file_header.raw_size = isCompressed(file_header) ? read_amount : 0;
+}
+
+// Frame data is stored as it is when compression doesn't make it smaller
+void CorrectingArchive::compressBlock(BlockBuffers& buffers) const {
+    std::vector<unsigned char>& packed = buffers.packed;
+    packed.assign(PACKED_HEADER_SIZE, 0);
+    LzCodec::compress(buffers.data, compression_level, packed);
+    uint32_t packed_size = packed.size() - PACKED_HEADER_SIZE;
+    if (packed_size >= buffers.data.size()) {
+        packed.resize(PACKED_HEADER_SIZE);
+        packed.insert(packed.end(), buffers.data.begin(), buffers.data.end());
+        packed_size = buffers.data.size() | STORED_FRAME;
+    }
+    uint64_t sizes = buffers.data.size() | static_cast<uint64_t>(packed_size) << 32;
+    for (size_t i = 0; i < PACKED_HEADER_SIZE; i++) {
+        packed[i] = sizes >> (i * BITS_IN_BYTE);
+    }
+}
+
+/*
+    Decompresses every complete frame at the start of unpacking.frames and writes it to out,
+    the rest is kept for the next decoded block. Returns false for a damaged frame
+*/
+bool CorrectingArchive::unpackFrames(Unpacking& unpacking, size_t max_block_size, std::ostream& out) {
+    std::vector<unsigned char>& frames = unpacking.frames;
+    size_t pos = 0;
+    while (frames.size() - pos >= PACKED_HEADER_SIZE) {
+        uint64_t sizes = 0;
+        for (size_t i = 0; i < PACKED_HEADER_SIZE; i++) {
+            sizes |= static_cast<uint64_t>(frames[pos + i]) << (i * BITS_IN_BYTE);
+        }
+        uint32_t block_size = sizes;
+        uint32_t packed_size = (sizes >> 32) & ~STORED_FRAME;
+        if (frames.size() - pos - PACKED_HEADER_SIZE < packed_size) {
+            break;
+        }
+        std::span<const unsigned char> packed(frames.data() + pos + PACKED_HEADER_SIZE, packed_size);
+        if (block_size > max_block_size) {
+            return false;
+        }
+        if (sizes >> 32 & STORED_FRAME) {
+            if (packed_size != block_size) {
+                return false;
+            }
+            out.write(reinterpret_cast<const char*>(packed.data()), packed.size());
+        } else {
+            unpacking.block.resize(block_size);
+            if (!LzCodec::decompress(packed, unpacking.block)) {
+                return false;
+            }
+            out.write(reinterpret_cast<char*>(unpacking.block.data()), block_size);
+        }
+        unpacking.unpacked += block_size;
+        pos += PACKED_HEADER_SIZE + packed_size;
+    }
+    frames.erase(frames.begin(), frames.begin() + pos);
+    return true;
+}
+
+// Returns false when nothing is left to read
+bool CorrectingArchive::readBlock(std::istream& file, std::vector<unsigned char>& block, size_t block_size) {
+    block.resize(block_size);
+    file.read(reinterpret_cast<char*>(block.data()), block_size);
+    block.resize(file.gcount());
+    return !block.empty();
+}
+
+// Frame of whole chunks close to FRAME_SIZE, 8 chunks always take whole bytes
+size_t CorrectingArchive::getFrameSize(uint16_t chunk_size) {
+    return static_cast<size_t>(chunk_size) * std::max<size_t>(FRAME_SIZE / chunk_size, 1);
+}
+
+// Block of whole frames close to BYTES_BLOCK_SIZE
+size_t CorrectingArchive::getBlockSize(uint16_t chunk_size) {
+    size_t frame_size = getFrameSize(chunk_size);
+    return frame_size * std::max<size_t>(BYTES_BLOCK_SIZE / frame_size, 1);
+}
+
+void CorrectingArchive::setThreadsAmount(uint16_t amount) {
+    threads_amount = std::max<uint16_t>(amount, 1);
+}
+
+void CorrectingArchive::setMappedReading(bool enabled) {
+    mapped_reading = enabled;
+}
+
+void CorrectingArchive::setErrorRate(double rate) {
+    error_rate = rate;
+}
+
+void CorrectingArchive::setSystematic(bool enabled) {
+    systematic = enabled;
+}
+
+void CorrectingArchive::setCompressionLevel(uint8_t level) {
+    compression_level = level;
+}
+
+void CorrectingArchive::setDeduplication(bool enabled) {
+    deduplication = enabled;
+}
+
+/*
+    Largest chunk with a specialized codec which keeps the probability of an uncorrectable codeword
+    in a file of file_size bits below MAX_LOSS_PROBABILITY, the smallest one if none does
+*/
+uint16_t CorrectingArchive::chooseChunkSize(uint64_t file_size) const {
+    for (uint16_t chunk_size : AUTO_CHUNK_SIZES) {
+        uint64_t chunk_amount = std::max<uint64_t>((file_size + chunk_size - 1) / chunk_size, 1);
+        double failure = HammingCode::getFailureProbability(HammingCode::getEncodedChunkSize(chunk_size), error_rate);
+        double loss = -std::expm1(chunk_amount * std::log1p(-failure));
+        if (loss <= MAX_LOSS_PROBABILITY) {
+            return chunk_size;
+        }
     }
-    read_stream.skip(file_header.padding);
-    file_stream.close();
-    file.close();
+    return HammingCode::BYTE_CHUNK_SIZE;
 }
 
-uint64_t CorrectingArchive::getEncodedFileLength(const FileHeader& file_header) {
-    uint8_t control_bits_per_chunk = HammingCode::getControlBitsAmount(file_header.chunk_size);
+const Statistics& CorrectingArchive::getStatistics() const {
+    return statistics;
+}
+
+uint64_t CorrectingArchive::getChunkAmount(const FileHeader& file_header) {
+    return file_header.file_size / file_header.chunk_size + static_cast<bool>(file_header.file_size % file_header.chunk_size);
+}
+
+uint64_t CorrectingArchive::getEncodedFileLength(const FileHeader& file_header) const {
+    if (isSystematic(file_header)) {
+        uint64_t block_bits = getBlockSize(file_header.chunk_size) * BITS_IN_BYTE;
+        return file_header.file_size / block_bits * getEncodedBlockSize(file_header, block_bits)
+            + getEncodedBlockSize(file_header, file_header.file_size % block_bits);
+    }
+    uint64_t chunk_amount = getChunkAmount(file_header);
     uint64_t file_length =
-        file_header.file_size / file_header.chunk_size * control_bits_per_chunk // Amount of all control bits
-            + file_header.file_size
+        chunk_amount * HammingCode::getEncodedChunkSize(file_header.chunk_size)
             + file_header.padding;
     return file_length;
 }
 
 void CorrectingArchive::extractFiles(std::vector<std::string>& file_names, std::string& path) {
-    std::ifstream read_archive(archive_path, std::ios::in | std::ios::binary);
-    if (!read_archive.is_open()) {
+    loadIndex();
+    std::vector<const IndexEntry*> entries;
+    for (auto& entry : index) {
+        if (!(entry.file_header.flags & DELETED_FLAG)
+            && std::find(file_names.begin(), file_names.end(), entry.file_header.file_name) != file_names.end()) {
+            entries.push_back(&entry);
+        }
+    }
+    if (!extractEntries(entries, path, std::cout)) {
         invalidArchive();
     }
+}
 
-    bitReader read_stream(read_archive);
-    std::ofstream file;
-    read_stream.skip(EXTENDED_HEADER_SIZE);
-    for (uint16_t i = 0; i < files_number; i++) {
-        struct FileHeader file_header = readFileHeader(read_stream);
-        if (std::find(file_names.begin(), file_names.end(), file_header.file_name) != file_names.end()) {
-            extractFile(read_stream, file_header, path);
-        } else {
-            nextFile(file_header, read_stream);
+void CorrectingArchive::extractAllFiles(std::string& path) {
+    loadIndex();
+    std::vector<const IndexEntry*> entries;
+    for (auto& entry : index) {
+        if (!(entry.file_header.flags & DELETED_FLAG)) {
+            entries.push_back(&entry);
         }
     }
+    if (!extractEntries(entries, path, std::cout)) {
+        invalidArchive();
+    }
 }
 
-void CorrectingArchive::extractAllFiles(std::string& path) {
-    std::ifstream read_archive(archive_path, std::ios::in | std::ios::binary);
-    if (!read_archive.is_open()) {
+/*
+    Reads encoded blocks of all entries one after another and decodes them on the thread pool,
+    so small files are decoded in parallel as well as blocks of a large one.
+    Blocks of framed archives are located by their offset and read by the pool threads themselves.
+    Decoded blocks are written in order, every file is opened when its first block is ready
+*/
+bool CorrectingArchive::extractEntries(const std::vector<const IndexEntry*>& entries,
+                                       std::string& path,
+                                       std::ostream& stream) {
+    ReadArchive read_archive;
+    openArchiveToRead(read_archive);
+    bitReader& read_stream = *read_archive.bit_stream;
+    bool framed = format_version >= FRAMED_VERSION;
+    if (framed && !read_archive.mapping.isMapped() && !read_archive.file.open(archive_path)) {
         invalidArchive();
     }
 
-    bitReader read_stream(read_archive);
+    ThreadPool pool(threads_amount > 1 ? threads_amount : 0);
     std::ofstream file;
-    read_stream.skip(EXTENDED_HEADER_SIZE);
-    for (uint16_t i = 0; i < files_number; i++) {
-        struct FileHeader file_header = readFileHeader(read_stream);
-        extractFile(read_stream, file_header, path);
+    bool to_stream = path == STANDARD_STREAM; // Files are written to stream one after another
+    std::ostream& out = to_stream ? stream : file;
+    size_t opened_entry = entries.size();
+    size_t first_file_statistics = statistics.files.size();
+    std::vector<const IndexEntry*> sources; // Entries which data is extracted, differ from entries for links
+    for (auto entry : entries) { // Added before the writer thread starts updating them
+        sources.push_back(&resolveLink(*entry));
+        const FileHeader& file_header = sources.back()->file_header;
+        uint64_t file_chunk_amount = getChunkAmount(file_header);
+        statistics.files.push_back({entry->file_header.file_name, getRawSize(file_header), file_chunk_amount, 0});
+        statistics.codewords_decoded += file_chunk_amount;
+        statistics.bytes_read += (getFileHeaderSize(file_header) + getEncodedFileLength(file_header)) / BITS_IN_BYTE;
+    }
+
+    // Whole file is unpacked once the data of the next file starts
+    Unpacking unpacking;
+    auto unpacked = [&](size_t entry_number) {
+      const FileHeader& file_header = sources[entry_number]->file_header;
+      return !isCompressed(file_header) || (unpacking.frames.empty() && unpacking.unpacked == file_header.raw_size);
+    };
+
+    // Decoded blocks with their entry numbers are written on a dedicated thread, so the next ones are read meanwhile
+    using NumberedBlock = std::pair<size_t, std::future<DecodedBlock>>;
+    BackgroundWriter<NumberedBlock> writer(PENDING_BLOCKS_PER_THREAD * pool.size(), [&](NumberedBlock& numbered_block) {
+      auto& [entry_number, decoded_block] = numbered_block;
+      DecodedBlock block = decoded_block.get();
+      if (!block.correct) {
+          return false;
+      }
+      std::vector<unsigned char>& data = block.buffers.data;
+      const FileHeader& file_header = sources[entry_number]->file_header;
+      auto start = Statistics::Clock::now();
+      if (entry_number != opened_entry) {
+          if (opened_entry < entries.size() && !unpacked(opened_entry)) {
+              return false;
+          }
+          if (!to_stream) {
+              file.close();
+              openFileToExtract(path, entries[entry_number]->file_header.file_name, file);
+          }
+          unpacking.unpacked = 0;
+      }
+      opened_entry = entry_number;
+      if (isCompressed(file_header)) {
+          uint64_t written = unpacking.unpacked;
+          unpacking.frames.insert(unpacking.frames.end(), data.begin(), data.end());
+          if (!unpackFrames(unpacking, getBlockSize(file_header.chunk_size), out)) {
+              return false;
+          }
+          statistics.bytes_written += unpacking.unpacked - written;
+      } else {
+          out.write(reinterpret_cast<char*>(data.data()), data.size());
+          statistics.bytes_written += data.size();
+      }
+      Statistics::addTime(statistics.io_time, start);
+      statistics.files[first_file_statistics + entry_number].corrected += block.corrected;
+      block_buffers.release(std::move(block.buffers));
+      return true;
+    });
+
+    bool writing = true;
+    for (size_t i = 0; i < entries.size() && writing; i++) {
+        const FileHeader& file_header = sources[i]->file_header;
+        uint64_t block_bits = getBlockSize(file_header.chunk_size) * BITS_IN_BYTE;
+        uint64_t file_length = file_header.file_size;
+        uint64_t block_offset = sources[i]->offset + getFileHeaderSize(file_header);
+        if (!framed) {
+            read_stream.seek(block_offset);
+        }
+        read_archive.mapping.willNeed(block_offset / BITS_IN_BYTE,
+                                      getEncodedFileLength(file_header) / BITS_IN_BYTE + 1);
+        do { // Empty files still get an empty block to be created
+            uint64_t decoded_bits = std::min(file_length, block_bits);
+            uint64_t encoded_bits = getEncodedBlockSize(file_header, decoded_bits);
+            std::future<DecodedBlock> decoded_block;
+            if (isSystematic(file_header)) {
+                decoded_block = pool.submit(
+                    [this, &read_archive, buffers = block_buffers.acquire(), offset = block_offset / BITS_IN_BYTE,
+                        data_size = decoded_bits / BITS_IN_BYTE, tail_bits = encoded_bits - decoded_bits,
+                        chunk_size = file_header.chunk_size]() mutable {
+                      auto start = Statistics::Clock::now();
+                      if (!readSystematicBlock(read_archive, offset, data_size, tail_bits, buffers)) {
+                          return DecodedBlock{false, 0, std::move(buffers)};
+                      }
+                      Statistics::addTime(statistics.io_time, start);
+                      start = Statistics::Clock::now();
+                      DecodedBlock block = decodeSystematicBlock(std::move(buffers), chunk_size);
+                      Statistics::addTime(statistics.coding_time, start);
+                      return block;
+                    });
+            } else if (framed) {
+                decoded_block = pool.submit(
+                    [this, &read_archive, buffers = block_buffers.acquire(), offset = block_offset / BITS_IN_BYTE,
+                        encoded_bits, chunk_size = file_header.chunk_size, decoded_bits]() mutable {
+                      auto start = Statistics::Clock::now();
+                      if (!readFrames(read_archive, offset, encoded_bits, buffers.encoded, buffers.read)) {
+                          return DecodedBlock{false, 0, std::move(buffers)};
+                      }
+                      Statistics::addTime(statistics.io_time, start);
+                      start = Statistics::Clock::now();
+                      DecodedBlock block = decodeBlock(std::move(buffers), chunk_size, decoded_bits);
+                      Statistics::addTime(statistics.coding_time, start);
+                      return block;
+                    });
+            } else {
+                auto start = Statistics::Clock::now();
+                BlockBuffers buffers = block_buffers.acquire();
+                buffers.encoded.clear();
+                try {
+                    read_stream.read(buffers.encoded, encoded_bits);
+                } catch (const std::out_of_range&) { // Archive is truncated
+                    buffers.encoded.clear();
+                }
+                Statistics::addTime(statistics.io_time, start);
+                decoded_block = pool.submit(
+                    [this, buffers = std::move(buffers), chunk_size = file_header.chunk_size, decoded_bits,
+                        encoded_bits]() mutable {
+                      if (buffers.encoded.size() != encoded_bits) {
+                          return DecodedBlock{false, 0, std::move(buffers)};
+                      }
+                      auto start = Statistics::Clock::now();
+                      DecodedBlock block = decodeBlock(std::move(buffers), chunk_size, decoded_bits);
+                      Statistics::addTime(statistics.coding_time, start);
+                      return block;
+                    });
+            }
+            writing = writer.push({i, std::move(decoded_block)});
+            file_length -= decoded_bits;
+            block_offset += encoded_bits; // Whole frames are byte-aligned, so next block is too
+        } while (file_length && writing);
+    }
+    return writer.finish() && (opened_entry >= entries.size() || unpacked(opened_entry));
+}
+
+/*
+    Reads encoded frames starting at byte offset into encoded, bytes is a buffer for positioned reads.
+    May be called from several threads at once
+*/
+bool CorrectingArchive::readFrames(const ReadArchive& read_archive,
+                                   uint64_t offset,
+                                   uint64_t encoded_bits,
+                                   bits& encoded,
+                                   std::vector<unsigned char>& bytes) {
+    size_t bytes_amount = alignToByte(encoded_bits) / BITS_IN_BYTE;
+    encoded.clear();
+    if (read_archive.mapping.isMapped()) {
+        if (offset + bytes_amount > read_archive.mapping.getSize()) {
+            return false;
+        }
+        encoded.appendBytes(read_archive.mapping.getData() + offset, bytes_amount);
+    } else {
+        bytes.resize(bytes_amount);
+        if (read_archive.file.readAt(offset, bytes.data(), bytes_amount) != bytes_amount) {
+            return false;
+        }
+        encoded.appendBytes(bytes.data(), bytes_amount);
+    }
+    encoded.resize(encoded_bits); // Drop padding of the last frame
+    return true;
+}
+
+// Decodes buffers.encoded into buffers.data
+CorrectingArchive::DecodedBlock CorrectingArchive::decodeBlock(BlockBuffers buffers,
+                                                               uint16_t chunk_size,
+                                                               uint64_t decoded_bits) {
+    DecodedBlock block{false, 0, std::move(buffers)};
+    BlockBuffers& decoded = block.buffers;
+    decoded.data.resize(decoded_bits / BITS_IN_BYTE);
+    block.correct = HammingCode::decodeInto(decoded.encoded, chunk_size, decoded.data, decoded.scratch, block.corrected);
+    return block;
+}
+
+// Reads data bytes of a systematic block into buffers.data, and its control bits and checksum into buffers.encoded
+bool CorrectingArchive::readSystematicBlock(const ReadArchive& read_archive,
+                                            uint64_t offset,
+                                            size_t data_size,
+                                            uint64_t tail_bits,
+                                            BlockBuffers& buffers) {
+    buffers.data.resize(data_size);
+    if (read_archive.mapping.isMapped()) {
+        if (offset + data_size > read_archive.mapping.getSize()) {
+            return false;
+        }
+        std::memcpy(buffers.data.data(), read_archive.mapping.getData() + offset, data_size);
+    } else if (read_archive.file.readAt(offset, buffers.data.data(), data_size) != data_size) {
+        return false;
+    }
+    return readFrames(read_archive, offset + data_size, tail_bits, buffers.encoded, buffers.read);
+}
+
+/*
+    Data with a matching checksum is taken as it is. Otherwise the block is decoded from codewords rebuilt
+    with its control bits, and the result is compared with the checksum when the checksum itself is readable
+*/
+CorrectingArchive::DecodedBlock CorrectingArchive::decodeSystematicBlock(BlockBuffers buffers,
+                                                                         uint16_t chunk_size) const {
+    DecodedBlock block{true, 0, std::move(buffers)};
+    BlockBuffers& decoded = block.buffers;
+    std::vector<unsigned char>& data = decoded.data;
+    if (data.empty()) {
+        return block;
+    }
+    uint64_t data_bits = data.size() * BITS_IN_BYTE;
+    uint64_t parity_bits = (data_bits + chunk_size - 1) / chunk_size * HammingCode::getControlBitsAmount(chunk_size);
+    bits checksum = decoded.encoded.view(parity_bits, CHECKSUM_INFO);
+    bool checksum_corrected = false;
+    bool checksum_valid = HammingCode::decodeChunk(checksum, CHECKSUM_CONTROL_BITS, checksum_corrected);
+    block.corrected += checksum_corrected;
+    if (checksum_valid && crc32c(data.data(), data.size()) == fromBits<uint32_t>(checksum)) {
+        return block;
+    }
+
+    decoded.scratch.clear();
+    decoded.scratch.appendBytes(data.data(), data.size());
+    HammingCode::buildCodewords(decoded.scratch, decoded.encoded.view(0, parity_bits), chunk_size, decoded.codewords);
+    decoded.scratch.clear();
+    if (!HammingCode::decodeChunks(decoded.codewords, chunk_size, decoded.scratch, block.corrected)) {
+        block.correct = false;
+        return block;
+    }
+    decoded.scratch.resize(data_bits);
+    decoded.scratch.toBytes(data.data());
+    block.correct = !checksum_valid || crc32c(data.data(), data.size()) == fromBits<uint32_t>(checksum);
+    return block;
+}
+
+void CorrectingArchive::encodeBlock(BlockBuffers& buffers, uint16_t chunk_size, bool systematic_block) const {
+    if (!systematic_block) {
+        HammingCode::encodeInto(buffers.data, chunk_size, buffers.encoded, buffers.scratch);
+        return;
+    }
+    buffers.encoded.clear(); // Data bytes are written as they are, only control bits and checksum are encoded
+    if (buffers.data.empty()) {
+        return;
+    }
+    buffers.scratch.clear();
+    buffers.scratch.appendBytes(buffers.data.data(), buffers.data.size());
+    HammingCode::encodeParity(buffers.scratch, chunk_size, buffers.encoded, buffers.codewords);
+    bits checksum = toBits(crc32c(buffers.data.data(), buffers.data.size()));
+    HammingCode::encodeChunk(checksum);
+    buffers.encoded.append(checksum);
+    buffers.encoded.resize(alignToByte(buffers.encoded.size()));
+}
+
+// Creates directories of a file stored with a relative path, names leading out of path are rejected
+void CorrectingArchive::openFileToExtract(const std::string& path, const std::string& file_name, std::ofstream& file) {
+    std::filesystem::path name = std::filesystem::path(file_name).lexically_normal();
+    if (name.is_absolute() || (!name.empty() && *name.begin() == "..")) {
+        std::cerr << "Invalid path\n";
+        exit(4);
+    }
+    std::filesystem::path file_path = std::filesystem::path(path) / name;
+    if (name.has_parent_path()) {
+        std::error_code error;
+        std::filesystem::create_directories(file_path.parent_path(), error);
+    }
+    file.open(file_path, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Invalid path\n";
+        exit(4);
+    }
+}
+
+void CorrectingArchive::loadIndex() {
+    if (index_loaded) {
+        return;
+    }
+    index_stored = readIndex();
+    if (!index_stored && !scanIndex()) {
+        invalidArchive();
+    }
+    files_number = index.size();
+    index_loaded = true;
+}
+
+// Reads index from the archive tail, returns false if there's no index or it's damaged
+bool CorrectingArchive::readIndex() {
+    ReadArchive read_archive;
+    openArchiveToRead(read_archive);
+    bitReader& read_stream = *read_archive.bit_stream;
+
+    uint64_t archive_size = std::filesystem::file_size(archive_path) * BITS_IN_BYTE;
+    if (archive_size < archive_header_size + FOOTER_SIZE) {
+        return false;
+    }
+
+    try {
+        bits field;
+        read_stream.seek(archive_size - FOOTER_SIZE);
+        if (!readChunk(read_stream, OFFSET_INFO, OFFSET_CONTROL_BITS, field)
+            || fromBits<uint64_t>(field) != INDEX_MAGIC) {
+            return false;
+        }
+        if (!readChunk(read_stream, OFFSET_INFO, OFFSET_CONTROL_BITS, field)) {
+            return false;
+        }
+        uint64_t files_end = fromBits<uint64_t>(field);
+        if (!readChunk(read_stream, OFFSET_INFO, OFFSET_CONTROL_BITS, field)) {
+            return false;
+        }
+        uint64_t entries_amount = fromBits<uint64_t>(field);
+
+        uint64_t index_start = alignToByte(files_end);
+        if (files_end < archive_header_size || entries_amount != files_number || index_start > archive_size) {
+            return false;
+        }
+
+        // Entries may have different sizes, so the index end is known only after they are read
+        std::vector<IndexEntry> entries;
+        read_stream.seek(index_start);
+        for (uint64_t i = 0; i < entries_amount; i++) {
+            IndexEntry entry;
+            if (!readChunk(read_stream, OFFSET_INFO, OFFSET_CONTROL_BITS, field)
+                || !readFileHeader(read_stream, entry.file_header)) {
+                return false;
+            }
+            entry.offset = fromBits<uint64_t>(field);
+            entries.push_back(entry);
+        }
+        if (alignToByte(read_stream.tell()) + FOOTER_SIZE != archive_size) {
+            return false;
+        }
+        index = std::move(entries);
+        data_end = files_end;
+    } catch (const std::out_of_range&) {
+        return false;
+    }
+    return true;
+}
+
+/*
+    Rebuilds index by reading file headers one after another.
+    Returns false if a header can't be decoded, index keeps the files before it
+*/
+bool CorrectingArchive::scanIndex() {
+    ReadArchive read_archive;
+    openArchiveToRead(read_archive);
+    bitReader& read_stream = *read_archive.bit_stream;
+
+    index.clear();
+    try {
+        read_stream.skip(archive_header_size);
+        for (uint64_t i = 0; i < files_number; i++) {
+            uint64_t offset = read_stream.tell();
+            struct FileHeader file_header;
+            if (!readFileHeader(read_stream, file_header)) {
+                return false;
+            }
+            index.push_back({offset, file_header});
+            nextFile(file_header, read_stream);
+        }
+    } catch (const std::out_of_range&) { // Damaged header points past the archive end
+        return false;
+    }
+    data_end = read_stream.tell();
+    return true;
+}
+
+void CorrectingArchive::writeIndex() {
+    archive.seekp(static_cast<std::streamoff>(alignToByte(data_end) / BITS_IN_BYTE));
+    uint64_t entries_size = 0;
+    for (auto& entry : index) {
+        writeNumber(entry.offset);
+        writeFileHeader(entry.file_header);
+        entries_size += OFFSET_INFO + getFileHeaderSize(entry.file_header);
+    }
+    archive_stream.write(bits(getIndexSize() - entries_size));
+
+    writeNumber(INDEX_MAGIC);
+    writeNumber(data_end);
+    writeNumber(index.size());
+    archive_stream.close();
+}
+
+// Encoded size of a block of decoded_bits bits of the file, see getBlockSize
+uint64_t CorrectingArchive::getEncodedBlockSize(const FileHeader& file_header, uint64_t decoded_bits) const {
+    uint64_t chunk_amount = (decoded_bits + file_header.chunk_size - 1) / file_header.chunk_size;
+    if (!isSystematic(file_header)) {
+        return chunk_amount * HammingCode::getEncodedChunkSize(file_header.chunk_size);
+    }
+    if (!decoded_bits) {
+        return 0;
+    }
+    return decoded_bits
+        + alignToByte(chunk_amount * HammingCode::getControlBitsAmount(file_header.chunk_size) + CHECKSUM_INFO);
+}
+
+bool CorrectingArchive::isSystematic(const FileHeader& file_header) {
+    return file_header.flags & SYSTEMATIC_FLAG;
+}
+
+bool CorrectingArchive::isCompressed(const FileHeader& file_header) {
+    return file_header.flags & COMPRESSED_FLAG;
+}
+
+uint64_t CorrectingArchive::getRawSize(const FileHeader& file_header) {
+    return isCompressed(file_header) ? file_header.raw_size : file_header.file_size / BITS_IN_BYTE;
+}
+
+bool CorrectingArchive::isLinked(const FileHeader& file_header) {
+    return file_header.flags & LINKED_FLAG;
+}
+
+// Original size of compressed files, content hash and link
+uint8_t CorrectingArchive::getNumberFieldsAmount(const FileHeader& file_header) {
+    return isCompressed(file_header) + (file_header.flags & HASHED_FLAG ? 2 : 0) + isLinked(file_header);
+}
+
+uint64_t CorrectingArchive::getIndexSize() const {
+    uint64_t index_size = 0;
+    for (auto& entry : index) {
+        index_size += OFFSET_INFO + getFileHeaderSize(entry.file_header);
     }
+    return alignToByte(index_size);
+}
+
+// Compact file headers are padded to a byte boundary, so their size depends on the file name and flags only
+uint64_t CorrectingArchive::getFileHeaderSize(const FileHeader& file_header) const {
+    if (format_version < COMPACT_VERSION) {
+        return file_header_size;
+    }
+    uint64_t name_bits = file_header.file_name.size() * BITS_IN_BYTE;
+    uint64_t name_chunks = (name_bits + NAME_CHUNK_SIZE - 1) / NAME_CHUNK_SIZE;
+    uint64_t fields_size = COMPACT_FIELDS_INFO + getNumberFieldsAmount(file_header) * FILE_SIZE_INFO;
+    return alignToByte(fields_size + name_chunks * HammingCode::getEncodedChunkSize(NAME_CHUNK_SIZE));
+}
+
+size_t CorrectingArchive::getMaxFileNameLength() const {
+    return format_version >= COMPACT_VERSION ? MAX_FILE_NAME_LENGTH : FILE_NAME_BITS / BITS_IN_BYTE;
+}
+
+uint64_t CorrectingArchive::alignToByte(uint64_t bit_pos) {
+    return (bit_pos + BITS_IN_BYTE - 1) / BITS_IN_BYTE * BITS_IN_BYTE;
+}
+
+void CorrectingArchive::writeNumber(uint64_t number) {
+    bits number_block = toBits(number);
+    HammingCode::encodeChunk(number_block);
+    archive_stream.write(number_block);
 }
 
 bool CorrectingArchive::archiveExists() {
@@ -205,61 +1670,309 @@ bool CorrectingArchive::archiveExists() {
 
 void CorrectingArchive::openArchiveToWrite() {
     if (archive.is_open()) {
-        archive.close();
+        return;
     } else if (!archiveExists()) {
         createEmptyArchive();
+        return;
+    }
+
+    loadIndex();
+    unsigned char last_byte = 0;
+    if (data_end % BITS_IN_BYTE) { // Last file of an old archive may end in the middle of a byte
+        ReadArchive read_archive;
+        openArchiveToRead(read_archive);
+        read_archive.bit_stream->seek(data_end / BITS_IN_BYTE * BITS_IN_BYTE);
+        last_byte = read_archive.bit_stream->readWord(data_end % BITS_IN_BYTE);
+    }
+
+    archive.open(archive_path, std::ios::binary | std::ios::in);
+    if (!archive.is_open()) {
+        invalidArchive();
+    }
+    archive.seekp(static_cast<std::streamoff>(data_end / BITS_IN_BYTE));
+    archive_stream.resume(last_byte, data_end % BITS_IN_BYTE);
+}
+
+// Returns false if the file isn't a regular one or can't be read, may be called from several threads at once
+bool CorrectingArchive::getFileHeader(const InputFile& file, uint16_t chunk_size, FileHeader& file_header) const {
+    std::error_code error;
+    uint64_t file_size = std::filesystem::file_size(file.path, error) * BITS_IN_BYTE;
+    if (error || !std::ifstream(file.path).is_open()) {
+        return false;
+    }
+    if (chunk_size == AUTO_CHUNK_SIZE) {
+        chunk_size = chooseChunkSize(file_size);
+    }
+
+    file_header.chunk_size = chunk_size;
+    file_header.file_size = file_size;
+    file_header.flags = systematic ? SYSTEMATIC_FLAG : 0;
+    if (compression_level && format_version >= COMPACT_VERSION) {
+        file_header.flags |= COMPRESSED_FLAG;
+        file_header.raw_size = file_size / BITS_IN_BYTE; // Until the file is written
+    }
+    if (deduplication && format_version >= COMPACT_VERSION) {
+        file_header.flags |= HASHED_FLAG;
     }
-    archive.open(archive_path, std::ios::ate | std::ios::binary | std::ios::in);
+    file_header.padding = isSystematic(file_header) ? 0 : getPaddingBitsAmount(file_size, chunk_size);
+    file_header.file_name = file.name.substr(0, getMaxFileNameLength());
+    return true;
 }
 
-struct FileHeader CorrectingArchive::writeFileHeader(const std::string& file_path, uint16_t chunk_size) {
-    std::filesystem::path p = file_path;
-    if (!std::filesystem::exists(p)) {
-        invalidFile(file_path);
+// Hash is computed by blocks of BYTES_BLOCK_SIZE, so it doesn't depend on the chunk size
+bool CorrectingArchive::hashFile(const std::string& file_path, FileHeader& file_header) {
+    std::ifstream file(file_path, std::ios::in | std::ios::binary);
+    std::vector<unsigned char> block;
+    ContentHash hash;
+    uint64_t hashed = 0;
+    while (readBlock(file, block, BYTES_BLOCK_SIZE)) {
+        hash = contentHash(block.data(), block.size(), hash);
+        hashed += block.size();
     }
-    uint64_t file_size = std::filesystem::file_size(p) * BITS_IN_BYTE;
+    file_header.content_hash = hash;
+    return file.eof() && hashed == file_header.file_size / BITS_IN_BYTE;
+}
 
-    bits chunk_size_block = toBits(chunk_size);
+CorrectingArchive::OriginalFiles CorrectingArchive::getOriginalFiles() {
+    loadIndex();
+    OriginalFiles originals;
+    for (auto& entry : index) {
+        const FileHeader& file_header = entry.file_header;
+        if (file_header.flags & HASHED_FLAG && !(file_header.flags & (LINKED_FLAG | DELETED_FLAG))) {
+            originals.emplace(std::pair(file_header.content_hash, getRawSize(file_header)), OriginalFile{entry.offset});
+        }
+    }
+    return originals;
+}
+
+/*
+    Turns the file at file_path which header will be at offset into a link when an original has the same content.
+    Hash isn't cryptographic, so files with the same hash and size are compared byte by byte before linking
+*/
+void CorrectingArchive::linkDuplicate(OriginalFiles& originals,
+                                      FileHeader& file_header,
+                                      uint64_t offset,
+                                      const std::string& file_path) const {
+    if (!(file_header.flags & HASHED_FLAG)) {
+        return;
+    }
+    auto [original, added] = originals.emplace(std::pair(file_header.content_hash, getRawSize(file_header)),
+                                               OriginalFile{offset, file_path});
+    if (added || !sameContent(original->second, file_path)) {
+        return;
+    }
+    file_header.flags = HASHED_FLAG | LINKED_FLAG;
+    file_header.link = original->second.offset;
+    file_header.file_size = 0;
+    file_header.padding = 0;
+    file_header.raw_size = 0;
+}
+
+/*
+    Original appended with the file is read from its input file, one already in the archive is decoded
+    by a reader of its own, so comparing isn't counted in statistics. A damaged original doesn't match
+*/
+bool CorrectingArchive::sameContent(const OriginalFile& original, const std::string& file_path) const {
+    ComparingBuffer buffer(file_path);
+    std::ostream out(&buffer);
+    if (!original.path.empty()) {
+        std::ifstream original_file(original.path, std::ios::in | std::ios::binary);
+        std::vector<unsigned char> block;
+        while (readBlock(original_file, block, BYTES_BLOCK_SIZE)) {
+            out.write(reinterpret_cast<char*>(block.data()), block.size());
+        }
+        return original_file.eof() && buffer.matchesFile();
+    }
+
+    auto entry = std::lower_bound(index.begin(), index.end(), original.offset,
+                                  [](const IndexEntry& e, uint64_t offset) { return e.offset < offset; });
+    if (entry == index.end() || entry->offset != original.offset) {
+        return false;
+    }
+    CorrectingArchive reader(archive_path);
+    reader.setThreadsAmount(threads_amount);
+    reader.setMappedReading(mapped_reading);
+    std::string path = STANDARD_STREAM;
+    return reader.extractEntries({&*entry}, path, out) && buffer.matchesFile();
+}
+
+// Entry which data is extracted for the given one, links point to earlier files which aren't links
+const IndexEntry& CorrectingArchive::resolveLink(const IndexEntry& entry) const {
+    if (!isLinked(entry.file_header)) {
+        return entry;
+    }
+    uint64_t link = entry.file_header.link;
+    auto original = std::lower_bound(index.begin(), index.end(), link, [](const IndexEntry& e, uint64_t offset) {
+      return e.offset < offset;
+    });
+    if (original == index.end() || original->offset != link || link >= entry.offset
+        || isLinked(original->file_header)) {
+        invalidArchive();
+    }
+    return *original;
+}
+
+void CorrectingArchive::writeFileHeader(const FileHeader& file_header) {
+    if (format_version >= COMPACT_VERSION) {
+        bits encoded_name = encodeFileName(file_header.file_name);
+        uint64_t fields_size = COMPACT_FIELDS_INFO + getNumberFieldsAmount(file_header) * FILE_SIZE_INFO;
+        archive_stream.write(encodeCompactFields(file_header));
+        if (isCompressed(file_header)) {
+            writeNumber(file_header.raw_size);
+        }
+        if (file_header.flags & HASHED_FLAG) {
+            writeNumber(file_header.content_hash.low);
+            writeNumber(file_header.content_hash.high);
+        }
+        if (isLinked(file_header)) {
+            writeNumber(file_header.link);
+        }
+        archive_stream.write(encoded_name);
+        archive_stream.write(bits(getFileHeaderSize(file_header) - fields_size - encoded_name.size()));
+        return;
+    }
+
+    bits chunk_size_block = toBits(file_header.chunk_size);
     HammingCode::encodeChunk(chunk_size_block);
     archive_stream.write(chunk_size_block);
 
-    bits file_size_block = toBits(file_size);
-    HammingCode::encodeChunk(file_size_block);
-    archive_stream.write(file_size_block);
+    writeNumber(file_header.file_size);
 
-    uint8_t padding_bits_amount = getPaddingBitsAmount(file_size, chunk_size);
-    bits padding_amount_block = toBits(padding_bits_amount);
+    bits padding_amount_block = toBits(file_header.padding);
     HammingCode::encodeChunk(padding_amount_block);
     archive_stream.write(padding_amount_block);
 
-    std::string file_name = file_path.substr(file_path.find_last_of("/\\") + 1);
-    file_name.resize(150, static_cast<char>(0));
+    if (format_version >= FRAMED_VERSION) {
+        bits flags_block = toBits(file_header.flags);
+        HammingCode::encodeChunk(flags_block);
+        archive_stream.write(flags_block);
+    }
+
+    std::string file_name = file_header.file_name;
+    file_name.resize(FILE_NAME_BITS / BITS_IN_BYTE, static_cast<char>(0));
     bits encoded_file_name = HammingCode::encodeString(file_name);
     archive_stream.write(encoded_file_name);
 
+    if (format_version >= FRAMED_VERSION) {
+        archive_stream.write(bits(FRAMED_FILE_HEADER_SIZE - LEGACY_FILE_HEADER_SIZE - FLAGS_INFO));
+    }
+}
+
+// Codeword of all fields of a compact file header but the file name
+bits CorrectingArchive::encodeCompactFields(const FileHeader& file_header) const {
+    bits fields;
+    fields.appendWord(file_header.chunk_size, CHUNK_SIZE_BITS);
+    fields.appendWord(file_header.file_size, FILE_SIZE_BITS);
+    fields.appendWord(file_header.padding, PADDING_BITS);
+    fields.appendWord(file_header.flags, FLAGS_BITS);
+    fields.appendWord(file_header.file_name.size(), NAME_LENGTH_BITS);
+    HammingCode::encodeChunk(fields);
+    return fields;
+}
+
+bits CorrectingArchive::encodeFileName(const std::string& file_name) {
+    bits name;
+    name.appendBytes(reinterpret_cast<const unsigned char*>(file_name.data()), file_name.size());
+    bits encoded_name;
+    HammingCode::encodeChunks(name, NAME_CHUNK_SIZE, encoded_name);
+    return encoded_name;
+}
+
+struct FileHeader CorrectingArchive::readFileHeader(bitReader& read_stream) const {
     struct FileHeader file_header;
-    file_header.chunk_size = chunk_size;
-    file_header.file_size = file_size;
-    file_header.padding = padding_bits_amount;
-    file_header.file_name = file_name;
+    if (!readFileHeader(read_stream, file_header)) {
+        invalidArchive();
+    }
     return file_header;
 }
 
-struct FileHeader CorrectingArchive::readFileHeader(bitReader& read_stream) const {
-    bits chunk_size_bits = readChunk(read_stream, CHUNK_SIZE_INFO, CHUNK_SIZE_CONTROL_BITS);
-    auto chunk_size = fromBits<uint16_t>(chunk_size_bits);
+// Returns false if any header field can't be decoded
+bool CorrectingArchive::readFileHeader(bitReader& read_stream, FileHeader& file_header) const {
+    if (format_version >= COMPACT_VERSION) {
+        return readCompactFileHeader(read_stream, file_header);
+    }
 
-    bits file_size_bits = readChunk(read_stream, FILE_SIZE_INFO, FILE_SIZE_CONTROL_BITS);
-    auto file_size = fromBits<uint64_t>(file_size_bits);
+    bits field;
+    if (!readChunk(read_stream, CHUNK_SIZE_INFO, CHUNK_SIZE_CONTROL_BITS, field)) {
+        return false;
+    }
+    file_header.chunk_size = fromBits<uint16_t>(field);
 
-    bits padding_bits = readChunk(read_stream, PADDING_INFO, PADDING_CONTROL_BITS);
+    if (!readChunk(read_stream, FILE_SIZE_INFO, FILE_SIZE_CONTROL_BITS, field)) {
+        return false;
+    }
+    file_header.file_size = fromBits<uint64_t>(field);
 
-    auto padding = fromBits<uint8_t>(padding_bits);
+    if (!readChunk(read_stream, PADDING_INFO, PADDING_CONTROL_BITS, field)) {
+        return false;
+    }
+    file_header.padding = fromBits<uint8_t>(field);
 
-    std::string file_name = readString(read_stream, FILE_NAME_INFO);
+    file_header.flags = 0;
+    if (format_version >= FRAMED_VERSION) {
+        if (!readChunk(read_stream, FLAGS_INFO, FLAGS_CONTROL_BITS, field)) {
+            return false;
+        }
+        file_header.flags = fromBits<uint8_t>(field);
+    }
 
-    struct FileHeader file_header = {chunk_size, file_size, padding, file_name};
-    return file_header;
+    if (!file_header.chunk_size || !readString(read_stream, FILE_NAME_INFO, file_header.file_name)) {
+        return false;
+    }
+    if (format_version >= FRAMED_VERSION) {
+        read_stream.skip(FRAMED_FILE_HEADER_SIZE - LEGACY_FILE_HEADER_SIZE - FLAGS_INFO);
+    }
+    return true;
+}
+
+bool CorrectingArchive::readCompactFileHeader(bitReader& read_stream, FileHeader& file_header) const {
+    bits fields;
+    if (!readChunk(read_stream, COMPACT_FIELDS_INFO, COMPACT_FIELDS_CONTROL_BITS, fields)) {
+        return false;
+    }
+    file_header.chunk_size = fields.getWord(0, CHUNK_SIZE_BITS);
+    file_header.file_size = fields.getWord(CHUNK_SIZE_BITS, FILE_SIZE_BITS);
+    file_header.padding = fields.getWord(CHUNK_SIZE_BITS + FILE_SIZE_BITS, PADDING_BITS);
+    file_header.flags = fields.getWord(CHUNK_SIZE_BITS + FILE_SIZE_BITS + PADDING_BITS, FLAGS_BITS);
+    size_t name_length = fields.getWord(COMPACT_FIELDS_BITS - NAME_LENGTH_BITS, NAME_LENGTH_BITS);
+    if (!file_header.chunk_size) {
+        return false;
+    }
+    uint64_t fields_size = COMPACT_FIELDS_INFO + getNumberFieldsAmount(file_header) * FILE_SIZE_INFO;
+    file_header.raw_size = 0;
+    file_header.content_hash = {};
+    file_header.link = 0;
+    std::vector<uint64_t*> numbers; // In the order of getNumberFieldsAmount
+    if (isCompressed(file_header)) {
+        numbers.push_back(&file_header.raw_size);
+    }
+    if (file_header.flags & HASHED_FLAG) {
+        numbers.push_back(&file_header.content_hash.low);
+        numbers.push_back(&file_header.content_hash.high);
+    }
+    if (isLinked(file_header)) {
+        numbers.push_back(&file_header.link);
+    }
+    for (uint64_t* number : numbers) {
+        if (!readChunk(read_stream, FILE_SIZE_INFO, FILE_SIZE_CONTROL_BITS, fields)) {
+            return false;
+        }
+        *number = fromBits<uint64_t>(fields);
+    }
+
+    file_header.file_name.assign(name_length, static_cast<char>(0));
+    uint64_t header_size = getFileHeaderSize(file_header);
+    bits encoded_name = read_stream.read(header_size - fields_size); // Name chunks and padding
+    uint64_t name_chunks = (name_length * BITS_IN_BYTE + NAME_CHUNK_SIZE - 1) / NAME_CHUNK_SIZE;
+    encoded_name.resize(name_chunks * HammingCode::getEncodedChunkSize(NAME_CHUNK_SIZE));
+    bits name;
+    uint64_t corrected = 0;
+    if (!HammingCode::decodeChunks(encoded_name, NAME_CHUNK_SIZE, name, corrected)) {
+        return false;
+    }
+    name.resize(name_length * BITS_IN_BYTE);
+    name.toBytes(reinterpret_cast<unsigned char*>(file_header.file_name.data()));
+    return true;
 }
 
 void CorrectingArchive::nextFile(struct FileHeader& file_header, bitReader& read_stream) {
@@ -270,22 +1983,32 @@ void CorrectingArchive::nextFile(struct FileHeader& file_header, bitReader& read
 bits CorrectingArchive::readChunk(bitReader& read_stream,
                                   uint32_t encoded_chunk_size,
                                   uint8_t control_bits_amount) {
-    bits chunk = read_stream.read(encoded_chunk_size);
-    bool correct = HammingCode::decodeChunk(chunk, control_bits_amount);
-    if (!correct) {
+    bits chunk;
+    if (!readChunk(read_stream, encoded_chunk_size, control_bits_amount, chunk)) {
         invalidArchive();
     }
     return chunk;
 }
 
-std::string CorrectingArchive::readString(bitReader& read_stream, uint32_t string_size) {
-    std::string s = HammingCode::decodeString(read_stream.read(string_size));
+bool CorrectingArchive::readChunk(bitReader& read_stream,
+                                  uint32_t encoded_chunk_size,
+                                  uint8_t control_bits_amount,
+                                  bits& chunk) {
+    chunk.clear();
+    read_stream.read(chunk, encoded_chunk_size);
+    return HammingCode::decodeChunk(chunk, control_bits_amount);
+}
+
+bool CorrectingArchive::readString(bitReader& read_stream, uint32_t string_size, std::string& s) {
+    s = HammingCode::decodeString(read_stream.read(string_size));
     if (s.empty()) {
-        invalidArchive();
+        return false;
     }
     auto it = s.find(static_cast<char>(0)); // Strip \0 chars at the end
-    s.erase(s.begin() + it, s.end());
-    return s;
+    if (it != std::string::npos) {
+        s.erase(s.begin() + it, s.end());
+    }
+    return true;
 }
 
 uint32_t CorrectingArchive::getStringControlBitsAmount(uint32_t string_size) {
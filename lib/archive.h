@@ -1,20 +1,91 @@
 #pragma once
 
+#include "content_hash.h"
 #include "hamming.h"
+#include "mapping.h"
+#include "positioned.h"
+#include "background.h"
+#include "statistics.h"
+#include "verification.h"
+#include "threadpool.h"
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <string>
 
 using Bits::bitReader;
 using Bits::bitWriter;
 
+struct FileHeader {
+  uint16_t chunk_size;
+  uint64_t file_size; // Bits of stored data, which are compressed frames for compressed files
+  uint8_t padding;
+  uint8_t flags = 0; // Stored since the framed format
+  uint64_t raw_size = 0; // Bytes of a compressed file before compression
+  ContentHash content_hash; // Stored for files appended with deduplication
+  uint64_t link = 0; // Offset of the header of a file with the same content, which data is used instead
+  std::string file_name; // Up to 150 bytes before the compact format
+};
+
+// File to append and the name it's stored under
+struct InputFile {
+  std::string path;
+  std::string name; // Path relative to the parent of an archived directory, separated by '/'
+};
+
+struct IndexEntry {
+  uint64_t offset; // Position of the file header in archive, in bits
+  FileHeader file_header;
+};
+
 /*
-    Archive starts with the number of files stored in archive (2 bytes)
-    Before each file next information is stored:
+    Archive starts with a header padded to a byte boundary:
+        format magic and version: 8 bytes, "HAMARC" and the version in the highest byte
+        number of files stored in archive: 8 bytes
+    Before each file next information is stored as a single codeword:
         chunk size: 2 bytes
         file size: 8 bytes
         padding bits amount: 1 byte
-        file name: max 100 characters (100 bytes)
+        flags: 1 byte, the lowest bit marks a deleted file
+        file name length: 2 bytes
+    followed by the file name split into chunks of NAME_CHUNK_SIZE bits.
+    File header is padded to a byte boundary. File data is split into frames of whole chunks
+    (see getFrameSize) taking whole bytes when encoded, so frame n starts n encoded frames after
+    the header and can be read and decoded on its own. The last frame is padded to a byte boundary.
+
+    Files with the systematic flag keep data bytes as they are. Each block of their data (see getBlockSize)
+    is followed by control bits of its chunks and a codeword of CRC-32C of the block, padded to a byte boundary.
+    Extraction copies blocks with a matching checksum and decodes only the rest.
+
+    Files with the compressed flag have the original size stored as a codeword after the fields codeword.
+    Their data is a sequence of frames, each compressing a block of the file read at once (see LzCodec):
+        size of the block: 4 bytes, little endian
+        size of the frame data: 4 bytes, the highest bit marks a block stored as it is
+        frame data
+    Frames are encoded like data of other files, so they are split into blocks regardless of frame bounds.
+
+    Files appended with deduplication have the hashed flag and a content hash of two codewords of 8 bytes,
+    following the original size. A file with the same content hash and size as an earlier one is compared with it
+    byte by byte and, if they are equal, gets the linked flag, the offset of the earlier file header as one more
+    codeword and no data of its own.
+
+    Framed archives (version 2) store the number of files in 2 bytes, and every field of a file header
+    as a separate codeword, with the file name padded with \0 to 150 bytes and encoded by bytes.
+    Legacy archives (version 1) have neither magic nor flags, and only the number of files is padded,
+    so their file headers and data are located by reading the archive bit by bit.
+    Files are appended to an archive in its own format, vacuum converts it to the current one.
+
+    Deleted files stay in the archive until it is vacuumed, which copies the rest to a new archive.
+
+    Index of all files follows the last file, starting on a byte boundary. Each entry is
+    the offset of the file header (8 bytes) followed by a copy of the file header.
+    Index is padded to a byte boundary and the archive ends with a footer:
+        index magic: 8 bytes
+        end of files data in bits: 8 bytes
+        entries amount: 8 bytes
+    Every field is stored as a separate Hamming code. Archives without a valid index
+    are read file by file.
 */
 class CorrectingArchive {
  public:
@@ -23,22 +94,120 @@ class CorrectingArchive {
 
   void createEmptyArchive();
 
+  // chunk_size is in bits, AUTO_CHUNK_SIZE chooses it by the file size and the error rate
   void appendFile(std::string& file_path, uint16_t chunk_size);
 
+  // Files are read and encoded on the thread pool at once and stored in the given order
+  void appendFiles(const std::vector<InputFile>& files, uint16_t chunk_size);
+
+  // Adds the file at path to files, regular files of a directory are added with their relative paths when recursive
+  void collectInputFiles(const std::string& path, bool recursive, std::vector<InputFile>& files) const;
+
+  void appendStream(std::istream& stream, const std::string& file_name, uint16_t chunk_size);
+
   void extractAllFiles(std::string& path);
 
+  // Files are written one after another to stdout when path is STANDARD_STREAM
   void extractFiles(std::vector<std::string>& file_names, std::string& path);
 
   std::vector<std::string> listFiles();
 
   void deleteFile(std::string& file_name);
 
+  void vacuum();
+
+  Verification verify();
+
+  Verification repair();
+
+  // Appends encoded files of source without decoding them
+  void appendArchive(CorrectingArchive& source);
+
+  void setThreadsAmount(uint16_t amount);
+
+  void setMappedReading(bool enabled);
+
+  // Expected probability of a flipped bit in the archive storage, used to choose AUTO_CHUNK_SIZE
+  void setErrorRate(double rate);
+
+  // Files appended afterwards get the systematic layout, legacy archives don't support it
+  void setSystematic(bool enabled);
+
+  // Files appended afterwards are compressed with the level from LzCodec, 0 turns compression off.
+  // Only compact archives support it
+  void setCompressionLevel(uint8_t level);
+
+  // Files appended afterwards with the same content as an earlier file, in the archive or among them,
+  // are stored as links to it. Only compact archives support it
+  void setDeduplication(bool enabled);
+
+  const Statistics& getStatistics() const;
+
+  static constexpr const char* STANDARD_STREAM = "-";
+
+  static constexpr uint16_t AUTO_CHUNK_SIZE = 0;
+
+  static constexpr uint16_t MAX_CHUNK_SIZE = ((1 << 13) - 1) * BITS_IN_BYTE;
+
  private:
   std::string const archive_path;
   std::ofstream archive;
   Bits::bitWriter archive_stream = Bits::bitWriter(archive);
 
-  uint16_t files_number;
+  uint64_t files_number;
+  std::vector<IndexEntry> index;
+  bool index_loaded = false;
+  bool index_stored = false; // Index was read from the archive tail
+  uint64_t data_end; // End of the last file in bits
+  uint16_t threads_amount = ThreadPool::defaultThreadsAmount();
+  bool mapped_reading = false;
+  double error_rate = DEFAULT_ERROR_RATE;
+  bool systematic = false;
+  uint8_t compression_level = 0;
+  bool deduplication = false;
+
+  /*
+      Buffers of a block being encoded or decoded. They move between the reading, coding and writing threads
+      with the block and are returned to block_buffers once it's written, so after the first blocks
+      encoding and decoding don't allocate
+  */
+  struct BlockBuffers {
+    std::vector<unsigned char> data; // Bytes of a file
+    std::vector<unsigned char> read; // Encoded bytes read from archive
+    bits encoded;
+    bits scratch;
+    bits codewords; // Rebuilt from a systematic block
+    std::vector<unsigned char> packed; // Frame of the compressed data
+  };
+
+  Recycler<BlockBuffers> block_buffers;
+  Statistics statistics;
+
+  uint8_t format_version;
+  uint16_t archive_header_size;
+  uint16_t file_header_size; // File headers have a fixed size before the compact format
+
+  struct ReadArchive {
+    std::ifstream stream;
+    MappedFile mapping;
+    std::unique_ptr<bitReader> bit_stream; // Reads either the stream or the mapping
+    PositionedFile file; // Frames of framed archives are read by pool threads when not mapped
+  };
+
+  static constexpr uint8_t LEGACY_VERSION = 1;
+  static constexpr uint8_t FRAMED_VERSION = 2;
+  static constexpr uint8_t COMPACT_VERSION = 3;
+  static constexpr uint8_t FORMAT_VERSION = COMPACT_VERSION; // Version of created archives
+
+  static constexpr uint8_t DELETED_FLAG = 1;
+  static constexpr uint8_t SYSTEMATIC_FLAG = 2;
+  static constexpr uint8_t COMPRESSED_FLAG = 4;
+  static constexpr uint8_t HASHED_FLAG = 8;
+  static constexpr uint8_t LINKED_FLAG = 16;
+
+  static constexpr uint64_t ARCHIVE_MAGIC = 0x4352414d4148; // "HAMARC"
+  static constexpr uint8_t VERSION_SHIFT = 56;
+
   const uint8_t FILES_NUMBER_SIZE = 2 * BITS_IN_BYTE;
   const uint8_t FILES_NUMBER_CONTROL_BITS = HammingCode::getControlBitsAmount(FILES_NUMBER_SIZE);
 
@@ -64,21 +233,201 @@ class CorrectingArchive {
   const uint16_t FILE_NAME_CONTROL_BITS = getStringControlBitsAmount(FILE_NAME_BITS / BITS_IN_BYTE);
   const uint16_t FILE_NAME_INFO = FILE_NAME_BITS + FILE_NAME_CONTROL_BITS;
 
-  const uint16_t FILE_HEADER_SIZE = CHUNK_SIZE_INFO + FILE_SIZE_INFO + PADDING_INFO + FILE_NAME_INFO;
+  const uint8_t FLAGS_BITS = 1 * BITS_IN_BYTE;
+  const uint8_t FLAGS_CONTROL_BITS = HammingCode::getControlBitsAmount(FLAGS_BITS);
+  const uint8_t FLAGS_INFO = FLAGS_BITS + FLAGS_CONTROL_BITS;
+
+  const uint16_t LEGACY_FILE_HEADER_SIZE = CHUNK_SIZE_INFO + FILE_SIZE_INFO + PADDING_INFO + FILE_NAME_INFO;
+  const uint16_t FRAMED_FILE_HEADER_SIZE = alignToByte(LEGACY_FILE_HEADER_SIZE + FLAGS_INFO);
+  const uint16_t FLAGS_OFFSET = CHUNK_SIZE_INFO + FILE_SIZE_INFO + PADDING_INFO; // Position in file header
+
+  const uint8_t OFFSET_BITS = 8 * BITS_IN_BYTE;
+  const uint8_t OFFSET_CONTROL_BITS = HammingCode::getControlBitsAmount(OFFSET_BITS);
+  const uint8_t OFFSET_INFO = OFFSET_BITS + OFFSET_CONTROL_BITS;
+
+  const uint16_t FRAMED_HEADER_SIZE = alignToByte(OFFSET_INFO + HEADER_SIZE);
+  const uint16_t COMPACT_HEADER_SIZE = alignToByte(2 * OFFSET_INFO); // Magic and 8 bytes number of files
+
+  const uint8_t NAME_LENGTH_BITS = 2 * BITS_IN_BYTE;
+  const uint8_t COMPACT_FIELDS_BITS = CHUNK_SIZE_BITS + FILE_SIZE_BITS + PADDING_BITS + FLAGS_BITS + NAME_LENGTH_BITS;
+  const uint8_t COMPACT_FIELDS_CONTROL_BITS = HammingCode::getControlBitsAmount(COMPACT_FIELDS_BITS);
+  const uint8_t COMPACT_FIELDS_INFO = COMPACT_FIELDS_BITS + COMPACT_FIELDS_CONTROL_BITS;
+
+  static constexpr uint16_t NAME_CHUNK_SIZE = 16 * BITS_IN_BYTE;
+  static constexpr size_t MAX_FILE_NAME_LENGTH = (1 << 16) - 1; // Bytes of a name in compact file headers
+
+  const uint8_t CHECKSUM_BITS = 4 * BITS_IN_BYTE;
+  const uint8_t CHECKSUM_CONTROL_BITS = HammingCode::getControlBitsAmount(CHECKSUM_BITS);
+  const uint8_t CHECKSUM_INFO = CHECKSUM_BITS + CHECKSUM_CONTROL_BITS;
+
+  const uint16_t FOOTER_FIELDS_SIZE = 3 * OFFSET_INFO; // Magic, end of data and entries amount
+  const uint16_t FOOTER_SIZE = FOOTER_FIELDS_SIZE + (BITS_IN_BYTE - FOOTER_FIELDS_SIZE % BITS_IN_BYTE) % BITS_IN_BYTE;
+
+  static constexpr uint64_t INDEX_MAGIC = 0x5845444e49464148; // "HAFINDEX"
+
+  static constexpr size_t FRAME_SIZE = 1 << 16; // Bytes of a file in one frame
+  static constexpr size_t PACKED_HEADER_SIZE = 8; // Block and frame data sizes of a compressed frame
+  static constexpr uint32_t STORED_FRAME = uint32_t(1) << 31;
+  static constexpr size_t BYTES_BLOCK_SIZE = 1 << 20; // Bytes encoded or decoded at once
+  static constexpr size_t PENDING_BLOCKS_PER_THREAD = 2;
+  static constexpr size_t READ_AHEAD_BLOCKS = 2; // Input blocks read while the current one is encoded
+  static constexpr size_t HEADERS_BATCH_SIZE = 256; // Input files checked by one pool task
+
+  static constexpr double DEFAULT_ERROR_RATE = 1e-9;
+  static constexpr double MAX_LOSS_PROBABILITY = 1e-6; // Of a file with AUTO_CHUNK_SIZE
+  static constexpr uint64_t STREAM_SIZE_ESTIMATE = uint64_t(1) << 33; // Bits of a stream of unknown size, 1 GiB
+  static constexpr uint16_t AUTO_CHUNK_SIZES[] = {4096, 2048, 1024, 512, 256, 128, 64, 32, 16, 8};
 
   void openArchiveToWrite();
 
-  void getNumberOfFiles();
+  void closeArchive();
+
+  void openArchiveToRead(ReadArchive& read_archive);
+
+  void readArchiveHeader();
+
+  void writeArchiveHeader();
+
+  void setFormatVersion(uint8_t version);
+
+  void loadIndex();
+
+  bool readIndex();
+
+  bool scanIndex();
+
+  void writeIndex();
+
+  bool getFileHeader(const InputFile& file, uint16_t chunk_size, FileHeader& file_header) const;
+
+  static bool hashFile(const std::string& file_path, FileHeader& file_header);
+
+  struct OriginalFile {
+    uint64_t offset; // Offset of the file header
+    std::string path; // Input file of the batch being appended, empty for files already in the archive
+  };
+
+  // Files which can be linked to, by content hash and size
+  using OriginalFiles = std::map<std::pair<ContentHash, uint64_t>, OriginalFile>;
+
+  OriginalFiles getOriginalFiles();
+
+  void linkDuplicate(OriginalFiles& originals, FileHeader& file_header, uint64_t offset,
+                     const std::string& file_path) const;
+
+  bool sameContent(const OriginalFile& original, const std::string& file_path) const;
+
+  const IndexEntry& resolveLink(const IndexEntry& entry) const;
+
+  void writeFileHeader(const FileHeader& file_header);
 
-  void setNumberOfFiles();
+  void writeNumber(uint64_t number);
 
-  struct FileHeader writeFileHeader(const std::string& file_path, uint16_t chunk_size);
+  bits encodeCompactFields(const FileHeader& file_header) const;
+
+  static bits encodeFileName(const std::string& file_name);
 
   struct FileHeader readFileHeader(bitReader& read_stream) const;
 
+  bool readFileHeader(bitReader& read_stream, FileHeader& file_header) const;
+
+  bool readCompactFileHeader(bitReader& read_stream, FileHeader& file_header) const;
+
+  uint64_t getFileHeaderSize(const FileHeader& file_header) const;
+
+  size_t getMaxFileNameLength() const;
+
   void nextFile(struct FileHeader& file_header, bitReader& read_stream);
 
-  void extractFile(bitReader& read_stream, struct FileHeader file_header, std::string& path);
+  void copyFiles(CorrectingArchive& source);
+
+  void copyEntry(ReadArchive& source, const IndexEntry& entry, uint64_t data_offset);
+
+  void copyData(ReadArchive& source, uint64_t offset, uint64_t bits_amount);
+
+  void patchBits(PositionedFile& file, uint64_t offset, bitView value);
+
+  struct DecodedBlock {
+    bool correct;
+    uint64_t corrected = 0; // Codewords with a fixed error
+    BlockBuffers buffers; // Decoded bytes are in data
+  };
+
+  // Files are written one after another to stream when path is STANDARD_STREAM, returns false if one is damaged
+  bool extractEntries(const std::vector<const IndexEntry*>& entries, std::string& path, std::ostream& stream);
+
+  static bool readFrames(const ReadArchive& read_archive, uint64_t offset, uint64_t encoded_bits, bits& encoded,
+                         std::vector<unsigned char>& bytes);
+
+  static DecodedBlock decodeBlock(BlockBuffers buffers, uint16_t chunk_size, uint64_t decoded_bits);
+
+  static bool readSystematicBlock(const ReadArchive& read_archive, uint64_t offset, size_t data_size,
+                                  uint64_t tail_bits, BlockBuffers& buffers);
+
+  DecodedBlock decodeSystematicBlock(BlockBuffers buffers, uint16_t chunk_size) const;
+
+  void encodeBlock(BlockBuffers& buffers, uint16_t chunk_size, bool systematic_block) const;
+
+  // Replaces buffers.packed with the compressed frame of buffers.data
+  void compressBlock(BlockBuffers& buffers) const;
+
+  // Compressed frames of the file being extracted
+  struct Unpacking {
+    std::vector<unsigned char> frames; // Decoded bytes starting with a frame which isn't complete yet
+    std::vector<unsigned char> block;
+    uint64_t unpacked = 0; // Bytes of the file written
+  };
+
+  static bool unpackFrames(Unpacking& unpacking, size_t max_block_size, std::ostream& out);
+
+  Verification scrub(bool repair);
+
+  struct CheckedBlock {
+    uint64_t corrected = 0;
+    uint64_t damaged_amount = 0;
+    std::vector<uint64_t> damaged; // Positions of damaged codewords in archive, first MAX_REPORTED_DAMAGE
+    std::vector<uint64_t> errors; // Positions of wrong bits in corrected codewords
+
+    void addDamage(uint64_t pos);
+
+    void add(const CheckedBlock& other);
+  };
+
+  static CheckedBlock checkBlock(const bits& encoded_block, uint64_t block_offset, uint16_t chunk_size);
+
+  static void checkCodewords(bitView encoded, uint32_t encoded_chunk_size, uint64_t offset, CheckedBlock& block);
+
+  CheckedBlock checkSystematicBlock(BlockBuffers& buffers, uint64_t block_offset, uint16_t chunk_size) const;
+
+  static CheckedBlock unreadableBlock(uint64_t block_offset, uint64_t chunk_amount, uint32_t chunk_step);
+
+  static CheckedBlock checkFields(bitReader& read_stream, uint64_t offset, const std::vector<uint32_t>& fields);
+
+  std::vector<uint32_t> getFileHeaderFields(const FileHeader& file_header) const;
+
+  CheckedBlock checkIndex(bitReader& read_stream) const;
+
+  static void flipBit(PositionedFile& file, uint64_t offset);
+
+  static void openFileToExtract(const std::string& path, const std::string& file_name, std::ofstream& file);
+
+  void appendEncodedStream(std::istream& stream, FileHeader& file_header);
+
+  void writeEncodedFile(std::istream& file, FileHeader& file_header);
+
+  struct EncodedBlock {
+    size_t file_number;
+    uint64_t offset; // Position of the block in its file, in bytes
+    std::future<BlockBuffers> buffers;
+  };
+
+  static bool readBlock(std::istream& file, std::vector<unsigned char>& block, size_t block_size);
+
+  uint16_t chooseChunkSize(uint64_t file_size) const;
+
+  static size_t getFrameSize(uint16_t chunk_size);
+
+  static size_t getBlockSize(uint16_t chunk_size);
 
   bool archiveExists();
 
@@ -88,7 +437,9 @@ class CorrectingArchive {
 
   static bits readChunk(bitReader& read_stream, uint32_t encoded_chunk_size, uint8_t control_bits_amount);
 
-  static std::string readString(bitReader& read_stream, uint32_t string_size);
+  static bool readChunk(bitReader& read_stream, uint32_t encoded_chunk_size, uint8_t control_bits_amount, bits& chunk);
+
+  static bool readString(bitReader& read_stream, uint32_t string_size, std::string& s);
 
   static uint8_t getPaddingBitsAmount(uint64_t file_size, uint16_t chunk_size);
 
@@ -96,12 +447,32 @@ class CorrectingArchive {
 
   static void printBits(bits& bts, std::string message);
 
-  static uint64_t getEncodedFileLength(const FileHeader& file_header);
-};
+  static uint64_t getChunkAmount(const FileHeader& file_header);
 
-struct FileHeader {
-  uint16_t chunk_size;
-  uint64_t file_size;
-  uint8_t padding;
-  std::string file_name;
-};
\ No newline at end of file
+  uint64_t getEncodedFileLength(const FileHeader& file_header) const;
+
+  uint64_t getEncodedBlockSize(const FileHeader& file_header, uint64_t decoded_bits) const;
+
+  static bool isSystematic(const FileHeader& file_header);
+
+  static bool isCompressed(const FileHeader& file_header);
+
+  // Bytes of the file before compression
+  static uint64_t getRawSize(const FileHeader& file_header);
+
+  static bool isLinked(const FileHeader& file_header);
+
+  // 8 byte codewords of a compact file header following the fields codeword
+  static uint8_t getNumberFieldsAmount(const FileHeader& file_header);
+
+  // Adds a file record written to the archive to statistics, encoded or copied from another archive
+  void countWrittenFile(const FileHeader& file_header, bool encoded);
+
+  // Adds the file written at data_end to the index
+  void addWrittenFile(const FileHeader& file_header, bool encoded);
+
+  // Size of the stored index of all files in index
+  uint64_t getIndexSize() const;
+
+  static uint64_t alignToByte(uint64_t bit_pos);
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Queue of at most `capacity` items passed between two threads.
+// Closing it wakes both sides up: push fails, pop returns the items left and then fails
+template<typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity) : capacity(std::max<size_t>(capacity, 1)) {}
+
+  // Waits for a free place, returns false if the queue is closed
+  bool push(T item) {
+      std::unique_lock<std::mutex> lock(mutex);
+      has_place.wait(lock, [this] { return closed || items.size() < capacity; });
+      if (closed) {
+          return false;
+      }
+      items.push_back(std::move(item));
+      has_item.notify_one();
+      return true;
+  }
+
+  // Waits for an item, returns false when the queue is closed and empty
+  bool pop(T& item) {
+      std::unique_lock<std::mutex> lock(mutex);
+      has_item.wait(lock, [this] { return closed || !items.empty(); });
+      if (items.empty()) {
+          return false;
+      }
+      item = std::move(items.front());
+      items.pop_front();
+      has_place.notify_one();
+      return true;
+  }
+
+  void close() {
+      {
+          std::lock_guard<std::mutex> lock(mutex);
+          closed = true;
+      }
+      has_item.notify_all();
+      has_place.notify_all();
+  }
+
+ private:
+  const size_t capacity;
+  std::deque<T> items;
+  std::mutex mutex;
+  std::condition_variable has_item;
+  std::condition_variable has_place;
+  bool closed = false;
+};
+
+// Reads up to `read_ahead` items on a dedicated thread while the previous ones are processed.
+// read fills an item and returns false at the end of input
+template<typename T>
+class BackgroundReader {
+ public:
+  BackgroundReader(size_t read_ahead, std::function<bool(T&)> read)
+      : queue(read_ahead), thread([this, read = std::move(read)] {
+          T item;
+          while (read(item) && queue.push(std::move(item))) {
+              item = T();
+          }
+          queue.close();
+        }) {}
+
+  ~BackgroundReader() {
+      queue.close();
+      thread.join();
+  }
+
+  // Returns false when all items were read
+  bool pop(T& item) {
+      return queue.pop(item);
+  }
+
+ private:
+  BoundedQueue<T> queue;
+  std::thread thread;
+};
+
+// Passes items to write on a dedicated thread in push order, at most `capacity` items wait.
+// Once write returns false the rest of items are dropped
+template<typename T>
+class BackgroundWriter {
+ public:
+  BackgroundWriter(size_t capacity, std::function<bool(T&)> write)
+      : queue(capacity), thread([this, write = std::move(write)] {
+          T item;
+          while (queue.pop(item)) {
+              if (!failed && !write(item)) {
+                  failed = true;
+                  queue.close();
+              }
+          }
+        }) {}
+
+  ~BackgroundWriter() {
+      finish();
+  }
+
+  // Returns false if a write failed
+  bool push(T item) {
+      return queue.push(std::move(item));
+  }
+
+  // Waits until every pushed item is written, returns false if a write failed
+  bool finish() {
+      if (thread.joinable()) {
+          queue.close();
+          thread.join();
+      }
+      return !failed;
+  }
+
+ private:
+  BoundedQueue<T> queue;
+  std::atomic<bool> failed = false;
+  std::thread thread;
+};
+
+// Items returned after use and handed out again instead of new ones, may be used from several threads
+template<typename T>
+class Recycler {
+ public:
+  // Returns a released item or a new one
+  T acquire() {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (items.empty()) {
+          return T();
+      }
+      T item = std::move(items.back());
+      items.pop_back();
+      return item;
+  }
+
+  void release(T item) {
+      std::lock_guard<std::mutex> lock(mutex);
+      items.push_back(std::move(item));
+  }
+
+ private:
+  std::vector<T> items;
+  std::mutex mutex;
+};
@@ -2,14 +2,260 @@
 #include <cstring>
 #include <iostream>
 
-Bits::bitReader::bitReader(std::istream& in) : in(in) {
-    std::fill(buff, buff + BUFF_SIZE, 0);
+Bits::word Bits::loadWord(const unsigned char* bytes) {
+    word result;
+    if constexpr (std::endian::native == std::endian::little) {
+        std::memcpy(&result, bytes, sizeof(result));
+    } else {
+        result = 0;
+        for (size_t i = 0; i < sizeof(result); i++) {
+            result |= static_cast<word>(bytes[i]) << (i * BITS_IN_BYTE);
+        }
+    }
+    return result;
+}
+
+void Bits::storeWord(unsigned char* bytes, word value) {
+    if constexpr (std::endian::native == std::endian::little) {
+        std::memcpy(bytes, &value, sizeof(value));
+    } else {
+        for (size_t i = 0; i < sizeof(value); i++) {
+            bytes[i] = static_cast<unsigned char>(value >> (i * BITS_IN_BYTE));
+        }
+    }
+}
+
+Bits::word Bits::loadBits(const word* words, size_t pos, uint8_t amount) {
+    if (amount == 0) {
+        return 0;
+    }
+    size_t index = pos / BITS_IN_WORD;
+    uint8_t shift = pos % BITS_IN_WORD;
+    word result = words[index] >> shift;
+    if (shift + amount > BITS_IN_WORD) {
+        result |= words[index + 1] << (BITS_IN_WORD - shift);
+    }
+    return result & lowBits(amount);
+}
+
+void Bits::storeBits(word* words, size_t pos, word value, uint8_t amount) {
+    if (amount == 0) {
+        return;
+    }
+    value &= lowBits(amount);
+    size_t index = pos / BITS_IN_WORD;
+    uint8_t shift = pos % BITS_IN_WORD;
+    words[index] = (words[index] & ~(lowBits(amount) << shift)) | (value << shift);
+    if (shift + amount > BITS_IN_WORD) {
+        uint8_t rest = shift + amount - BITS_IN_WORD;
+        words[index + 1] = (words[index + 1] & ~lowBits(rest)) | (value >> (BITS_IN_WORD - shift));
+    }
+}
+
+Bits::bitView::bitView(const word* words, size_t offset, size_t length)
+    : words(words), offset(offset), length(length) {}
+
+Bits::bit Bits::bitView::operator[](size_t pos) const {
+    pos += offset;
+    return (words[pos / BITS_IN_WORD] >> (pos % BITS_IN_WORD)) & 1;
+}
+
+Bits::word Bits::bitView::getWord(size_t pos, uint8_t amount) const {
+    return loadBits(words, offset + pos, amount);
+}
+
+Bits::bitView Bits::bitView::view(size_t pos, size_t amount) const {
+    return bitView(words, offset + pos, amount);
+}
+
+Bits::bits::bits(size_t size) : words(wordsFor(size)), length(size) {}
+
+Bits::bits::bits(bitView view) : bits(view.size()) {
+    copy(0, view);
+}
+
+size_t Bits::bits::wordsFor(size_t size) {
+    return (size + BITS_IN_WORD - 1) / BITS_IN_WORD;
+}
+
+Bits::bit Bits::bits::operator[](size_t pos) const {
+    return (words[pos / BITS_IN_WORD] >> (pos % BITS_IN_WORD)) & 1;
+}
+
+void Bits::bits::set(size_t pos, bit value) {
+    word mask = word(1) << (pos % BITS_IN_WORD);
+    if (value) {
+        words[pos / BITS_IN_WORD] |= mask;
+    } else {
+        words[pos / BITS_IN_WORD] &= ~mask;
+    }
+}
+
+void Bits::bits::flip(size_t pos) {
+    words[pos / BITS_IN_WORD] ^= word(1) << (pos % BITS_IN_WORD);
+}
+
+void Bits::bits::push_back(bit value) {
+    appendWord(value, 1);
+}
+
+void Bits::bits::resize(size_t size) {
+    if (size < length && size % BITS_IN_WORD) {
+        words[size / BITS_IN_WORD] &= lowBits(size % BITS_IN_WORD); // Keep tail bits zero
+    }
+    words.resize(wordsFor(size));
+    if (size < length) {
+        std::fill(words.begin() + wordsFor(size), words.end(), 0);
+    }
+    length = size;
+}
+
+// Grows capacity at least twice, so repeated appends stay amortized linear
+void Bits::bits::reserve(size_t size) {
+    if (wordsFor(size) > words.capacity()) {
+        words.reserve(std::max(wordsFor(size), 2 * words.capacity()));
+    }
+}
+
+void Bits::bits::clear() {
+    words.clear();
+    length = 0;
+}
+
+Bits::word Bits::bits::getWord(size_t pos, uint8_t amount) const {
+    return loadBits(words.data(), pos, amount);
+}
+
+void Bits::bits::setWord(size_t pos, word value, uint8_t amount) {
+    storeBits(words.data(), pos, value, amount);
+}
+
+void Bits::bits::appendWord(word value, uint8_t amount) {
+    if (amount == 0) {
+        return;
+    }
+    value &= lowBits(amount);
+    uint8_t shift = length % BITS_IN_WORD;
+    if (shift == 0) {
+        words.push_back(value);
+    } else {
+        words.back() |= value << shift;
+        if (shift + amount > BITS_IN_WORD) {
+            words.push_back(value >> (BITS_IN_WORD - shift));
+        }
+    }
+    length += amount;
+}
+
+void Bits::bits::append(bitView source) {
+    reserve(length + source.size());
+    size_t pos = 0;
+    while (pos < source.size()) {
+        uint8_t amount = std::min<size_t>(BITS_IN_WORD, source.size() - pos);
+        appendWord(source.getWord(pos, amount), amount);
+        pos += amount;
+    }
+}
+
+void Bits::bits::appendBytes(const unsigned char* bytes, size_t amount) {
+    reserve(length + amount * BITS_IN_BYTE);
+    size_t i = 0;
+    for (; i + sizeof(word) <= amount; i += sizeof(word)) {
+        appendWord(loadWord(bytes + i), BITS_IN_WORD);
+    }
+    for (; i < amount; i++) {
+        appendWord(bytes[i], BITS_IN_BYTE);
+    }
+}
+
+void Bits::bits::toBytes(unsigned char* bytes) const {
+    size_t amount = length / BITS_IN_BYTE;
+    size_t i = 0;
+    for (; i + sizeof(word) <= amount; i += sizeof(word)) {
+        storeWord(bytes + i, getWord(i * BITS_IN_BYTE, BITS_IN_WORD));
+    }
+    for (; i < amount; i++) {
+        bytes[i] = static_cast<unsigned char>(getWord(i * BITS_IN_BYTE, BITS_IN_BYTE));
+    }
+}
+
+void Bits::bits::copy(size_t pos, bitView source) {
+    size_t copied = 0;
+    while (copied < source.size()) {
+        uint8_t amount = std::min<size_t>(BITS_IN_WORD, source.size() - copied);
+        setWord(pos + copied, source.getWord(copied, amount), amount);
+        copied += amount;
+    }
+}
+
+Bits::bitView Bits::bits::view() const {
+    return bitView(words.data(), 0, length);
+}
+
+Bits::bitView Bits::bits::view(size_t pos, size_t amount) const {
+    return bitView(words.data(), pos, amount);
+}
+
+bool Bits::bits::operator==(const bits& other) const {
+    return length == other.length && words == other.words;
+}
+
+Bits::bitReader::bitReader(std::istream& in) : window(buff), in(&in) {
+    std::fill(buff, buff + sizeof(buff), 0);
+    std::streampos start = in.tellg();
+    seekable = start != std::streampos(-1);
+    buff_start = seekable ? static_cast<uint64_t>(start) : 0;
+    in.clear();
+}
+
+// Reads bits straight from memory, e.g. a mapped file, without copying them to the buffer
+Bits::bitReader::bitReader(const unsigned char* data, size_t size)
+    : window(data), read_chars_amount(size), in(nullptr) {}
+
+// Last words of a memory window are loaded through a copy to not read past its end
+Bits::word Bits::bitReader::loadWindowWord(size_t byte) const {
+    if (in || byte + sizeof(word) <= read_chars_amount) {
+        return loadWord(window + byte);
+    }
+    unsigned char tail[sizeof(word)] = {};
+    std::memcpy(tail, window + byte, read_chars_amount - byte);
+    return loadWord(tail);
 }
 
 Bits::bits Bits::bitReader::read(uint32_t n) {
-    bits result(n);
-    for (size_t i = 0; i < n; ++i) {
-        result[i] = readBit();
+    bits result;
+    read(result, n);
+    return result;
+}
+
+void Bits::bitReader::read(bits& result, uint64_t n) {
+    result.reserve(result.size() + n);
+    while (n) {
+        if (eof()) {
+            throw std::out_of_range("Trying to read, when nothing to read.");
+        }
+        size_t available = read_chars_amount * BITS_IN_CHAR - pos;
+        uint8_t amount = std::min<uint64_t>({n, available, MAX_WORD_READ});
+        word value = loadWindowWord(pos / BITS_IN_CHAR) >> (pos % BITS_IN_CHAR);
+        result.appendWord(value, amount);
+        pos += amount;
+        n -= amount;
+    }
+}
+
+Bits::word Bits::bitReader::readWord(uint8_t n) {
+    word result = 0;
+    uint8_t done = 0;
+    while (done < n) {
+        if (eof()) {
+            throw std::out_of_range("Trying to read, when nothing to read.");
+        }
+        size_t available = read_chars_amount * BITS_IN_CHAR - pos;
+        uint8_t amount = std::min<size_t>(n - done, available);
+        word value = loadWindowWord(pos / BITS_IN_CHAR) >> (pos % BITS_IN_CHAR);
+        result |= (value & lowBits(amount)) << done;
+        pos += amount;
+        done += amount;
     }
     return result;
 }
@@ -19,73 +265,146 @@ Bits::bit Bits::bitReader::readBit() {
         throw std::out_of_range("Trying to read, when nothing to read.");
     }
 
-    bit result = buff[pos / BITS_IN_CHAR] & (1 << (pos % BITS_IN_CHAR));
+    bit result = window[pos / BITS_IN_CHAR] & (1 << (pos % BITS_IN_CHAR));
     pos++;
     return result;
 }
 
 bool Bits::bitReader::eof() {
     fillBuff();
-    return pos == read_chars_amount * BITS_IN_CHAR && in.eof();
+    return pos == read_chars_amount * BITS_IN_CHAR && (!in || !in->good());
 }
 
 void Bits::bitReader::fillBuff() {
-    if (pos == read_chars_amount * BITS_IN_CHAR) {
-        in.read(reinterpret_cast<char*>(buff), BUFF_SIZE);
-        read_chars_amount = in.gcount();
+    if (in && pos == read_chars_amount * BITS_IN_CHAR) {
+        buff_start += read_chars_amount;
+        in->read(reinterpret_cast<char*>(buff), BUFF_SIZE);
+        read_chars_amount = in->gcount();
         pos = 0;
     }
 }
 
 void Bits::bitReader::refresh() {
-    in.clear();
-    in.seekg(0);
+    if (!in) {
+        pos = 0;
+        return;
+    }
+    in->clear();
+    in->seekg(0);
+    buff_start = 0;
     pos = 0;
     read_chars_amount = 0;
     std::memset(buff, 0, sizeof(buff));
 }
 
+// Moves inside the buffer when possible, otherwise seeks the stream
 void Bits::bitReader::skip(uint64_t skip_bits) {
-    // Not working fast skip
+    size_t buffered = read_chars_amount * BITS_IN_CHAR - pos;
+    if (skip_bits <= buffered) {
+        pos += skip_bits;
+        return;
+    }
+
+    if (in && !seekable) {
+        // Discard whole buffers of a pipe without keeping them
+        skip_bits -= buffered;
+        pos = read_chars_amount * BITS_IN_CHAR;
+        while (skip_bits && !eof()) {
+            size_t amount = std::min<uint64_t>(skip_bits, read_chars_amount * BITS_IN_CHAR - pos);
+            pos += amount;
+            skip_bits -= amount;
+        }
+        return;
+    }
 
-//    std::streampos tpos = in.tellg(); // Position in file
-//    std::streampos sbuff_size = static_cast<std::streampos>(BUFF_SIZE);
-//    std::streampos cur_pos = static_cast<std::streampos>(pos / BITS_IN_CHAR) + tpos / sbuff_size; // Position of last read char in file
-//    size_t pos_in_char = (pos % BITS_IN_CHAR) + (skip_bits % BITS_IN_CHAR);
-//    std::streampos skip_chars = static_cast<std::streampos>(skip_bits / BITS_IN_CHAR + pos_in_char / BITS_IN_CHAR);
-//    std::streampos new_pos = cur_pos + skip_chars;
-//    in.seekg(new_pos);
-//    pos = 0;
-//    read_chars_amount = 0;
-//    std::memset(buff, 0, sizeof(buff));
-//    fillBuff();
+    seek(tell() + skip_bits);
+}
 
-    // Working slow skip
-    read(skip_bits);
+// Seeks the stream to the byte containing bit_pos and refills the buffer
+void Bits::bitReader::seek(uint64_t bit_pos) {
+    if (!in) {
+        pos = std::min<uint64_t>(bit_pos, read_chars_amount * BITS_IN_CHAR);
+        return;
+    }
+    in->clear();
+    in->seekg(static_cast<std::streamoff>(bit_pos / BITS_IN_CHAR));
+    buff_start = bit_pos / BITS_IN_CHAR;
+    in->read(reinterpret_cast<char*>(buff), BUFF_SIZE);
+    read_chars_amount = in->gcount();
+    pos = std::min<size_t>(bit_pos % BITS_IN_CHAR, read_chars_amount * BITS_IN_CHAR);
+}
 
+uint64_t Bits::bitReader::tell() const {
+    return buff_start * BITS_IN_CHAR + pos;
 }
 
 Bits::bitWriter::bitWriter(std::ofstream& out) : out(out) {
-    std::fill(buff, buff + BUFF_SIZE, 0);
+    std::fill(buff, buff + sizeof(buff), 0);
 }
 
-void Bits::bitWriter::write(const bits& bs) {
-    for (auto b : bs) {
-        writeBit(b);
+void Bits::bitWriter::write(bitView bs) {
+    size_t written = 0;
+    while (written < bs.size()) {
+        uint8_t amount = std::min<size_t>(MAX_WORD_WRITE, bs.size() - written);
+        writeWord(bs.getWord(written, amount), amount);
+        written += amount;
     }
 }
 
-void Bits::bitWriter::writeBit(Bits::bit b) {
-    buff[pos / BITS_IN_CHAR] |= (b << (pos % BITS_IN_CHAR));
-    ++pos;
+void Bits::bitWriter::writeBytes(const unsigned char* bytes, size_t amount) {
+    if (pos % BITS_IN_CHAR) {
+        size_t written = 0;
+        for (; written + sizeof(word) <= amount; written += MAX_WORD_WRITE / BITS_IN_CHAR) {
+            writeWord(loadWord(bytes + written), MAX_WORD_WRITE);
+        }
+        for (; written < amount; written++) {
+            writeWord(bytes[written], BITS_IN_CHAR);
+        }
+        return;
+    }
+    out.write(reinterpret_cast<char*>(buff), pos / BITS_IN_CHAR);
+    std::memset(buff, 0, sizeof(buff));
+    pos = 0;
+    out.write(reinterpret_cast<const char*>(bytes), static_cast<std::streamsize>(amount));
+}
 
-    if (pos == BITS_IN_BUFF) {
-        out.write(reinterpret_cast<char*>(buff), BUFF_SIZE);
-        pos = 0;
-        std::memset(buff, 0, sizeof(buff));
+void Bits::bitWriter::writeWord(word value, uint8_t n) {
+    unsigned char* dest = buff + pos / BITS_IN_CHAR;
+    storeWord(dest, loadWord(dest) | ((value & lowBits(n)) << (pos % BITS_IN_CHAR)));
+    pos += n;
+
+    if (pos >= BITS_IN_BUFF) {
+        flushBuff();
     }
 }
 
+void Bits::bitWriter::writeBit(Bits::bit b) {
+    writeWord(b, 1);
+}
+
+void Bits::bitWriter::flushBuff() {
+    out.write(reinterpret_cast<char*>(buff), BUFF_SIZE);
+    pos -= BITS_IN_BUFF;
+    // Move bits written past the buffer end to its beginning
+    std::memcpy(buff, buff + BUFF_SIZE, sizeof(word));
+    std::memset(buff + sizeof(word), 0, BUFF_SIZE);
+}
+
+// Continues a partially written byte, the next written bit goes to position used_bits of last_byte
+void Bits::bitWriter::resume(unsigned char last_byte, uint8_t used_bits) {
+    buff[0] = last_byte & lowBits(used_bits);
+    pos = used_bits;
+}
+
+void Bits::bitWriter::flush() {
+    size_t bytes_amount = pos / BITS_IN_CHAR;
+    out.write(reinterpret_cast<char*>(buff), bytes_amount);
+    unsigned char last_byte = buff[bytes_amount];
+    std::memset(buff, 0, sizeof(buff));
+    buff[0] = last_byte;
+    pos %= BITS_IN_CHAR;
+}
+
 void Bits::bitWriter::close() {
     if (pos) {
         out.write(reinterpret_cast<char*>(buff),
@@ -1,39 +1,161 @@
+#pragma once
+
 #include <algorithm>
+#include <bit>
 #include <cstdint>
 #include <fstream>
 #include <vector>
 
 namespace Bits {
 using bit = bool;
-using bits = std::vector<bit>;
+using word = uint64_t;
 
 constexpr uint8_t BITS_IN_BYTE = 8;
 constexpr size_t BITS_IN_CHAR = BITS_IN_BYTE;
+constexpr uint8_t BITS_IN_WORD = 64;
+
+// Mask with the lowest `amount` bits set, amount <= 64
+constexpr word lowBits(uint8_t amount) {
+    return amount >= BITS_IN_WORD ? ~word(0) : (word(1) << amount) - 1;
+}
+
+// Reverses the lowest `amount` bits of value
+constexpr word reverseBits(word value, uint8_t amount) {
+    value = ((value >> 1) & 0x5555555555555555ull) | ((value & 0x5555555555555555ull) << 1);
+    value = ((value >> 2) & 0x3333333333333333ull) | ((value & 0x3333333333333333ull) << 2);
+    value = ((value >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((value & 0x0F0F0F0F0F0F0F0Full) << 4);
+    value = ((value >> 8) & 0x00FF00FF00FF00FFull) | ((value & 0x00FF00FF00FF00FFull) << 8);
+    value = ((value >> 16) & 0x0000FFFF0000FFFFull) | ((value & 0x0000FFFF0000FFFFull) << 16);
+    value = (value >> 32) | (value << 32);
+    return amount ? value >> (BITS_IN_WORD - amount) : 0;
+}
+
+// Reads `amount` <= 64 bits starting at bit pos of a packed word array
+word loadBits(const word* words, size_t pos, uint8_t amount);
+
+// Overwrites `amount` <= 64 bits starting at bit pos of a packed word array
+void storeBits(word* words, size_t pos, word value, uint8_t amount);
+
+// Little-endian word load and store for byte buffers
+word loadWord(const unsigned char* bytes);
+
+void storeWord(unsigned char* bytes, word value);
+
+// Non-owning view of a range of packed bits
+class bitView {
+ public:
+  bitView() = default;
+
+  bitView(const word* words, size_t offset, size_t length);
+
+  size_t size() const { return length; }
+
+  bool empty() const { return length == 0; }
+
+  bit operator[](size_t pos) const;
+
+  word getWord(size_t pos, uint8_t amount) const;
+
+  bitView view(size_t pos, size_t amount) const;
+
+ private:
+  const word* words = nullptr;
+  size_t offset = 0;
+  size_t length = 0;
+};
+
+/*
+    Packed bit container.
+    Bit i is stored in words[i / 64] at position i % 64, so a byte buffer read least significant
+    bit first has the same layout as the words on a little-endian machine.
+    Bits after size() in the last word are always zero.
+*/
+class bits {
+ public:
+  bits() = default;
+
+  explicit bits(size_t size);
+
+  bits(bitView view);
+
+  size_t size() const { return length; }
+
+  bool empty() const { return length == 0; }
+
+  bit operator[](size_t pos) const;
+
+  void set(size_t pos, bit value);
+
+  void flip(size_t pos);
+
+  void push_back(bit value);
+
+  void resize(size_t size);
+
+  void reserve(size_t size);
 
+  void clear();
+
+  word getWord(size_t pos, uint8_t amount) const;
+
+  void setWord(size_t pos, word value, uint8_t amount);
+
+  void appendWord(word value, uint8_t amount);
+
+  void append(bitView source);
+
+  // Appends bytes least significant bit first, like bitReader reads them
+  void appendBytes(const unsigned char* bytes, size_t amount);
+
+  // Writes size() / 8 whole bytes, least significant bit first
+  void toBytes(unsigned char* bytes) const;
+
+  // Overwrites bits starting at pos with source, pos + source.size() <= size()
+  void copy(size_t pos, bitView source);
+
+  bitView view() const;
+
+  bitView view(size_t pos, size_t amount) const;
+
+  operator bitView() const { return view(); }
+
+  word* data() { return words.data(); }
+
+  const word* data() const { return words.data(); }
+
+  size_t wordsAmount() const { return words.size(); }
+
+  bool operator==(const bits& other) const;
+
+ private:
+  std::vector<word> words;
+  size_t length = 0;
+
+  static size_t wordsFor(size_t size);
+};
+
+// Most significant bit of element goes first
 template<typename T>
 bits toBits(T element) {
-    size_t result_size = BITS_IN_BYTE * sizeof(T);
+    constexpr uint8_t result_size = BITS_IN_BYTE * sizeof(T);
     bits result(result_size);
-    for (size_t pos = 0; pos < result_size; pos++) {
-        result[result_size - pos - 1] = element & (1ll << pos);
-    }
+    auto value = static_cast<word>(element) & lowBits(result_size);
+    result.setWord(0, reverseBits(value, result_size), result_size);
     return result;
 }
 
 template<typename T>
-T fromBits(const bits& bts) {
-    T result = 0;
-    size_t result_size = BITS_IN_BYTE * sizeof(T);
-    for (std::size_t pos = 0; pos < result_size; ++pos) {
-        result |= (static_cast<uint64_t>(bts[result_size - pos - 1]) << pos);
-    }
-    return result;
+T fromBits(bitView bts) {
+    constexpr uint8_t result_size = BITS_IN_BYTE * sizeof(T);
+    return static_cast<T>(reverseBits(bts.getWord(0, result_size), result_size));
 }
 
 struct bitReader {
  public:
   explicit bitReader(std::istream&);
 
+  bitReader(const unsigned char* data, size_t size);
+
   bit readBit();
 
   void refresh();
@@ -42,17 +164,34 @@ struct bitReader {
 
   bits read(uint32_t);
 
+  // Appends n bits to result
+  void read(bits& result, uint64_t n);
+
+  // Reads n <= 56 bits, first read bit goes to the least significant bit
+  word readWord(uint8_t n);
+
   void skip(uint64_t);
 
+  void seek(uint64_t bit_pos);
+
+  // Position of the next read bit in stream
+  uint64_t tell() const;
+
   bool eof();
 
 // private:
   static const constexpr size_t BUFF_SIZE = 1 << 16;
-  unsigned char buff[BUFF_SIZE];
+  static const constexpr uint8_t MAX_WORD_READ = BITS_IN_WORD - BITS_IN_BYTE;
+  unsigned char buff[BUFF_SIZE + sizeof(word)];
+  const unsigned char* window; // Bytes being read, buff or memory given to constructor
   size_t pos = 0;
   size_t read_chars_amount = 0;
-  std::istream& in;
+  uint64_t buff_start = 0; // Stream offset of window[0]
+  bool seekable = true;
+  std::istream* in; // nullptr when reading from memory
   void fillBuff();
+
+  word loadWindowWord(size_t byte) const;
 };
 
 struct bitWriter {
@@ -61,15 +200,29 @@ struct bitWriter {
 
   void writeBit(bit);
 
-  void write(const bits&);
+  void write(bitView);
+
+  // Writes bytes least significant bit first, straight to the stream when on a byte boundary
+  void writeBytes(const unsigned char* bytes, size_t amount);
+
+  // Writes the lowest n <= 56 bits of value, least significant bit first
+  void writeWord(word value, uint8_t n);
+
+  void resume(unsigned char last_byte, uint8_t used_bits);
+
+  // Writes whole bytes to the stream, a partially written byte stays in the buffer
+  void flush();
 
   void close();
 
 // private:
   static const size_t BUFF_SIZE = 1 << 15;
-  unsigned char buff[BUFF_SIZE];
-  static const size_t BITS_IN_BUFF = BITS_IN_CHAR * sizeof(buff);
+  static const constexpr uint8_t MAX_WORD_WRITE = BITS_IN_WORD - BITS_IN_BYTE;
+  unsigned char buff[BUFF_SIZE + sizeof(word)];
+  static const size_t BITS_IN_BUFF = BITS_IN_CHAR * BUFF_SIZE;
   size_t pos = 0;
   std::ofstream& out;
+
+  void flushBuff();
 };
 } // namespace Bits
@@ -0,0 +1,30 @@
+#include "comparing_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+ComparingBuffer::ComparingBuffer(const std::string& file_path)
+    : file(file_path, std::ios::in | std::ios::binary), block(BLOCK_SIZE) {
+    same = file.is_open();
+}
+
+bool ComparingBuffer::matchesFile() {
+    return same && file.peek() == std::ifstream::traits_type::eof();
+}
+
+std::streamsize ComparingBuffer::xsputn(const char* data, std::streamsize size) {
+    for (std::streamsize compared = 0; compared < size && same;) {
+        std::streamsize amount = std::min<std::streamsize>(size - compared, block.size());
+        file.read(block.data(), amount);
+        same = file.gcount() == amount && std::memcmp(block.data(), data + compared, amount) == 0;
+        compared += amount;
+    }
+    return same ? size : 0;
+}
+
+ComparingBuffer::int_type ComparingBuffer::overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+        return traits_type::not_eof(c);
+    }
+    char byte = traits_type::to_char_type(c);
+    return xsputn(&byte, 1) == 1 ? c : traits_type::eof();
+}
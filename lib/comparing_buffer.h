@@ -0,0 +1,27 @@
+#pragma once
+
+#include <fstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Output buffer checking that bytes written to it are the contents of a file, writes fail after the first difference
+class ComparingBuffer : public std::streambuf {
+ public:
+  explicit ComparingBuffer(const std::string& file_path);
+
+  // True if the file was opened, every written byte matched and the whole file was written
+  bool matchesFile();
+
+ protected:
+  std::streamsize xsputn(const char* data, std::streamsize size) override;
+
+  int_type overflow(int_type c) override;
+
+ private:
+  std::ifstream file;
+  std::vector<char> block;
+  bool same;
+
+  static constexpr size_t BLOCK_SIZE = 1 << 16;
+};
@@ -0,0 +1,41 @@
+#include "content_hash.h"
+#include <bit>
+#include <cstring>
+
+namespace {
+const uint64_t PRIME_1 = 0x9e3779b185ebca87;
+const uint64_t PRIME_2 = 0xc2b2ae3d27d4eb4f;
+const uint64_t PRIME_3 = 0x165667b19e3779f9;
+const uint64_t PRIME_4 = 0x85ebca77c2b2ae63;
+
+uint64_t mix(uint64_t lane, uint64_t word, uint64_t multiplier, uint64_t prime, int rotation) {
+    return std::rotl(lane ^ word * multiplier, rotation) * prime;
+}
+
+// Spreads every bit of the lane over the whole result
+uint64_t avalanche(uint64_t lane) {
+    lane ^= lane >> 33;
+    lane *= PRIME_2;
+    lane ^= lane >> 29;
+    lane *= PRIME_3;
+    return lane ^ lane >> 32;
+}
+} // namespace
+
+ContentHash contentHash(const unsigned char* data, size_t size, ContentHash hash) {
+    uint64_t low = hash.low ^ PRIME_4;
+    uint64_t high = hash.high ^ PRIME_1;
+    for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        low = mix(low, word, PRIME_2, PRIME_1, 31);
+        high = mix(high, word, PRIME_4, PRIME_3, 27);
+    }
+    uint64_t tail = size; // Length is mixed in too, so trailing zero bytes change the hash
+    for (size_t i = 0; i < size; i++) {
+        tail |= static_cast<uint64_t>(data[i]) << (8 * (i + 1));
+    }
+    low = mix(low, tail, PRIME_2, PRIME_1, 31);
+    high = mix(high, tail, PRIME_4, PRIME_3, 27);
+    return {avalanche(low), avalanche(high ^ low)};
+}
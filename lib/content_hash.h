@@ -0,0 +1,17 @@
+#pragma once
+
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+
+// 128-bit hash of file contents, two independent 64-bit lanes
+struct ContentHash {
+  uint64_t low = 0;
+  uint64_t high = 0;
+
+  auto operator<=>(const ContentHash&) const = default;
+};
+
+// Hash of size bytes continuing hash of the preceding parts. Not cryptographic, it tells apart
+// different files met in practice, not ones built to collide
+ContentHash contentHash(const unsigned char* data, size_t size, ContentHash hash = {});
@@ -0,0 +1,76 @@
+#include "crc32c.h"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define HAS_SSE42_CRC
+#endif
+
+namespace {
+const uint32_t POLYNOMIAL = 0x82f63b78; // Reversed Castagnoli polynomial
+const size_t SLICES = 8;
+
+// TABLES[k][b] is the CRC of byte b followed by k zero bytes
+constexpr auto makeTables() {
+    std::array<std::array<uint32_t, 256>, SLICES> tables{};
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int i = 0; i < 8; i++) {
+            crc = crc & 1 ? crc >> 1 ^ POLYNOMIAL : crc >> 1;
+        }
+        tables[0][b] = crc;
+    }
+    for (size_t k = 1; k < SLICES; k++) {
+        for (uint32_t b = 0; b < 256; b++) {
+            tables[k][b] = tables[k - 1][b] >> 8 ^ tables[0][tables[k - 1][b] & 0xff];
+        }
+    }
+    return tables;
+}
+
+constexpr auto TABLES = makeTables();
+
+uint32_t softwareCrc32c(const unsigned char* data, size_t size, uint32_t crc) {
+    for (; size >= SLICES; data += SLICES, size -= SLICES) {
+        uint64_t word;
+        std::memcpy(&word, data, SLICES);
+        word ^= crc; // Bytes are taken least significant first, as on little-endian machines
+        crc = TABLES[7][word & 0xff] ^ TABLES[6][word >> 8 & 0xff] ^ TABLES[5][word >> 16 & 0xff]
+            ^ TABLES[4][word >> 24 & 0xff] ^ TABLES[3][word >> 32 & 0xff] ^ TABLES[2][word >> 40 & 0xff]
+            ^ TABLES[1][word >> 48 & 0xff] ^ TABLES[0][word >> 56];
+    }
+    for (; size; data++, size--) {
+        crc = crc >> 8 ^ TABLES[0][(crc ^ *data) & 0xff];
+    }
+    return crc;
+}
+
+#ifdef HAS_SSE42_CRC
+__attribute__((target("sse4.2")))
+uint32_t hardwareCrc32c(const unsigned char* data, size_t size, uint32_t crc) {
+    uint64_t crc_word = crc;
+    for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc_word = _mm_crc32_u64(crc_word, word);
+    }
+    crc = crc_word;
+    for (; size; data++, size--) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+#endif
+} // namespace
+
+uint32_t crc32c(const unsigned char* data, size_t size, uint32_t crc) {
+    crc = ~crc;
+#ifdef HAS_SSE42_CRC
+    static const bool hardware = __builtin_cpu_supports("sse4.2");
+    if (hardware) {
+        return ~hardwareCrc32c(data, size, crc);
+    }
+#endif
+    return ~softwareCrc32c(data, size, crc);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli) of size bytes continuing crc of the preceding bytes.
+// Uses the SSE 4.2 crc32 instruction when the processor has it, tables sliced by 8 bytes otherwise
+uint32_t crc32c(const unsigned char* data, size_t size, uint32_t crc = 0);
@@ -1,134 +1,404 @@
 #include "error_codes.h"
 #include "hamming.h"
+#include "hamming_codec.h"
+#include <array>
+#include <cmath>
+#include <utility>
+
+using Bits::word;
+using Bits::BITS_IN_WORD;
+
+namespace {
+constexpr uint8_t LOW_POSITION_BITS = 6; // Position bits that repeat inside each word
+
+// LOW_POSITION_MASKS[k] marks bits of a word which positions have bit k set
+constexpr word lowPositionMask(uint8_t k) {
+    word mask = 0;
+    for (uint8_t i = 0; i < BITS_IN_WORD; i++) {
+        if (((i + 1) >> k) & 1) {
+            mask |= word(1) << i;
+        }
+    }
+    return mask;
+}
+
+constexpr word LOW_POSITION_MASKS[LOW_POSITION_BITS] = {
+    lowPositionMask(0), lowPositionMask(1), lowPositionMask(2),
+    lowPositionMask(3), lowPositionMask(4), lowPositionMask(5),
+};
+
+constexpr uint16_t ENCODED_BYTE_MASK = 0xFFF;
+constexpr uint16_t DECODED_CORRECTED = 1 << 8;
+constexpr uint16_t DECODED_INVALID = 1 << 9;
+constexpr uint8_t BYTES_IN_BLOCK = 4; // 4 encoded bytes fill 48 bits of a word
+
+constexpr bool isPowerOfTwo(uint32_t x) {
+    return x && !(x & (x - 1));
+}
+
+constexpr uint16_t encodedByteSyndrome(uint16_t codeword) {
+    uint16_t syndrome = 0;
+    for (uint8_t i = 0; i < 12; i++) {
+        if ((codeword >> i) & 1) {
+            syndrome ^= i + 1;
+        }
+    }
+    return syndrome;
+}
+
+constexpr uint16_t encodeByte(uint8_t value) {
+    uint16_t codeword = 0;
+    uint8_t placed = 0;
+    for (uint8_t i = 0; i < 12; i++) {
+        if (!isPowerOfTwo(i + 1)) {
+            codeword |= ((value >> placed++) & 1) << i;
+        }
+    }
+    uint16_t syndrome = encodedByteSyndrome(codeword);
+    for (uint8_t control_bit = 0; control_bit < 4; control_bit++) {
+        codeword |= ((syndrome >> control_bit) & 1) << ((1 << control_bit) - 1);
+    }
+    return codeword;
+}
+
+// Decoded byte in the lower 8 bits with DECODED_CORRECTED and DECODED_INVALID flags above
+constexpr uint16_t decodeByte(uint16_t codeword) {
+    uint16_t syndrome = encodedByteSyndrome(codeword);
+    uint16_t flags = 0;
+    if (syndrome > 12) {
+        return DECODED_INVALID;
+    } else if (syndrome) {
+        codeword ^= 1 << (syndrome - 1);
+        flags = DECODED_CORRECTED;
+    }
+    uint16_t value = 0;
+    uint8_t extracted = 0;
+    for (uint8_t i = 0; i < 12; i++) {
+        if (!isPowerOfTwo(i + 1)) {
+            value |= ((codeword >> i) & 1) << extracted++;
+        }
+    }
+    return value | flags;
+}
+
+template<size_t N, typename F>
+constexpr std::array<uint16_t, N> makeTable(F f) {
+    std::array<uint16_t, N> table{};
+    for (size_t i = 0; i < N; i++) {
+        table[i] = f(i);
+    }
+    return table;
+}
+
+constexpr auto ENCODE_TABLE = makeTable<1 << 8>(encodeByte);
+constexpr auto DECODE_TABLE = makeTable<1 << 12>(decodeByte);
+
+// Chunk sizes with a HammingCodec specialization
+using SpecializedChunkSizes = std::integer_sequence<uint16_t, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096>;
+
+// Calls f with HammingCodec<chunk_size>, returns false if there's no specialization for chunk_size
+template<typename F, uint16_t... ChunkSizes>
+bool withCodec(uint16_t chunk_size, std::integer_sequence<uint16_t, ChunkSizes...>, F&& f) {
+    return ((chunk_size == ChunkSizes && (f(HammingCodec<ChunkSizes>()), true)) || ...);
+}
+
+// Strings are encoded most significant bit first, see toBits
+uint8_t reverseByte(char c) {
+    return Bits::reverseBits(static_cast<uint8_t>(c), BITS_IN_BYTE);
+}
+} // namespace
 
 void HammingCode::encodeChunk(bits& chunk) {
+    bits encoded_chunk;
+    encodeChunk(chunk, encoded_chunk);
+    chunk = std::move(encoded_chunk);
+}
+
+void HammingCode::encodeChunk(bitView chunk, bits& encoded_chunk) {
     uint32_t encoded_chunk_size = getEncodedChunkSize(chunk.size());
     uint8_t control_bits_amount = encoded_chunk_size - chunk.size();
 
-    bits encoded_chunk(encoded_chunk_size);
-    uint32_t offset = 2;
-    // Placed value bits
-    for (uint32_t i = 2; i < encoded_chunk_size; i++) {
-        if (isPowerOfTwo(i + 1)) {
-            offset++;
-            continue;
-        }
-        encoded_chunk[i] = chunk[i - offset];
+    encoded_chunk.resize(encoded_chunk_size);
+    for (uint8_t control_bit = 0; control_bit < control_bits_amount; control_bit++) {
+        encoded_chunk.set((1 << control_bit) - 1, 0); // Left from the previous chunk
     }
+    placeValueBits(chunk, encoded_chunk);
 
-    bits control_bits = calculateControlBits(encoded_chunk, control_bits_amount);
+    uint32_t control_bits = calculateSyndrome(encoded_chunk);
 
     // Set control bits
     for (uint8_t control_bit = 0; control_bit < control_bits_amount; control_bit++) {
         uint32_t control_pos = (1 << control_bit) - 1; // 2^(control_bit) - 1
-        encoded_chunk[control_pos] = control_bits[control_bit];
+        encoded_chunk.set(control_pos, (control_bits >> control_bit) & 1);
     }
-
-    chunk = encoded_chunk;
 }
 
 // Decodes encoded_chunk and returns true if decoded successfully, otherwise returns false
 bool HammingCode::decodeChunk(bits& encoded_chunk, uint8_t control_bits_amount) {
-    bits decoded_chunk(encoded_chunk.size() - control_bits_amount);
-    bits control_bits(control_bits_amount);
+    bool corrected;
+    return decodeChunk(encoded_chunk, control_bits_amount, corrected);
+}
 
-    bits recalculated_control_bits = calculateControlBits(encoded_chunk, control_bits_amount);
+bool HammingCode::decodeChunk(bits& encoded_chunk, uint8_t control_bits_amount, bool& corrected) {
+    bits decoded_chunk;
+    if (!decodeChunk(encoded_chunk, control_bits_amount, decoded_chunk, corrected)) {
+        return false;
+    }
+    encoded_chunk = std::move(decoded_chunk);
+    return true;
+}
 
-    // If control bits are different and there's an error
-    if (!compareControlBits(control_bits, recalculated_control_bits)) {
-        uint16_t error_pos = 0;
-        // Find error position
-        for (uint8_t i = 0; i < control_bits_amount; i++) {
-            error_pos += static_cast<uint16_t>(recalculated_control_bits[i]) << i;
+bool HammingCode::decodeChunk(bitView encoded_chunk, uint8_t control_bits_amount, bits& chunk, bool& corrected) {
+    uint32_t error_pos = calculateSyndrome(encoded_chunk);
+
+    // Non-zero syndrome is the position of a single error
+    corrected = error_pos;
+    if (error_pos > encoded_chunk.size()) {
+        return false;
+    }
+
+    chunk.resize(encoded_chunk.size() - control_bits_amount);
+    extractValueBits(encoded_chunk, chunk);
+    if (error_pos && !std::has_single_bit(error_pos)) { // Errors in control bits don't change the value
+        chunk.flip(error_pos - 1 - std::bit_width(error_pos)); // Value bits before it skip bit_width control bits
+    }
+    return true;
+}
+
+uint32_t HammingCode::getErrorPosition(bitView encoded_chunk) {
+    return calculateSyndrome(encoded_chunk);
+}
+
+void HammingCode::encodeChunks(bitView data, uint16_t chunk_size, bits& encoded) {
+    encoded.reserve(encoded.size() + (data.size() + chunk_size - 1) / chunk_size * getEncodedChunkSize(chunk_size));
+    if (withCodec(chunk_size, SpecializedChunkSizes(), [&](auto codec) { codec.encode(data, encoded); })) {
+        return;
+    }
+
+    bits last_chunk(chunk_size);
+    bits encoded_chunk;
+    for (size_t pos = 0; pos < data.size(); pos += chunk_size) {
+        if (pos + chunk_size <= data.size()) {
+            encodeChunk(data.view(pos, chunk_size), encoded_chunk);
+        } else {
+            last_chunk.copy(0, data.view(pos, data.size() - pos)); // Padded with zeros
+            encodeChunk(last_chunk, encoded_chunk);
         }
-        encoded_chunk[error_pos - 1] = !encoded_chunk[error_pos - 1]; // Correct error
+        encoded.append(encoded_chunk);
     }
+}
 
-    // Check if there's still an error
-    recalculated_control_bits = calculateControlBits(encoded_chunk, control_bits_amount);
+bool HammingCode::decodeChunks(bitView encoded, uint16_t chunk_size, bits& decoded, uint64_t& corrected) {
+    uint32_t encoded_chunk_size = getEncodedChunkSize(chunk_size);
+    decoded.reserve(decoded.size() + encoded.size() / encoded_chunk_size * chunk_size);
+    bool valid = true;
+    if (withCodec(chunk_size, SpecializedChunkSizes(), [&](auto codec) {
+        valid = codec.decode(encoded, decoded, corrected);
+    })) {
+        return valid;
+    }
 
-    if (!compareControlBits(control_bits, recalculated_control_bits)) {
-        return false;
+    uint8_t control_bits_amount = getControlBitsAmount(chunk_size);
+    bits chunk;
+    bool chunk_corrected;
+    for (size_t pos = 0; pos + encoded_chunk_size <= encoded.size(); pos += encoded_chunk_size) {
+        if (!decodeChunk(encoded.view(pos, encoded_chunk_size), control_bits_amount, chunk, chunk_corrected)) {
+            return false;
+        }
+        corrected += chunk_corrected;
+        decoded.append(chunk);
     }
+    return true;
+}
 
-    // Remove control bits from encoded_chunk
-    for (uint8_t control_bit = 0; control_bit < control_bits_amount; control_bit++) {
-        uint32_t control_pos = (1 << control_bit) - 1;
-        encoded_chunk.erase(encoded_chunk.begin() + control_pos - control_bit);
+void HammingCode::encodeInto(std::span<const unsigned char> data, uint16_t chunk_size, bits& encoded, bits& scratch) {
+    encoded.clear();
+    if (chunk_size == BYTE_CHUNK_SIZE) {
+        encodeBytes(data.data(), data.size(), encoded);
+        return;
     }
+    scratch.clear();
+    scratch.appendBytes(data.data(), data.size());
+    encodeChunks(scratch, chunk_size, encoded);
+}
 
+bool HammingCode::decodeInto(bitView encoded,
+                             uint16_t chunk_size,
+                             std::span<unsigned char> data,
+                             bits& scratch,
+                             uint64_t& corrected) {
+    if (chunk_size == BYTE_CHUNK_SIZE) {
+        return decodeBytes(encoded.view(0, data.size() * BITS_IN_ENCODED_BYTE), data.data(), corrected);
+    }
+    scratch.clear();
+    if (!decodeChunks(encoded, chunk_size, scratch, corrected)) {
+        return false;
+    }
+    scratch.resize(data.size() * BITS_IN_BYTE); // Drop padding of the last chunk
+    scratch.toBytes(data.data());
     return true;
 }
 
+void HammingCode::encodeParity(bitView data, uint16_t chunk_size, bits& parity, bits& codewords) {
+    codewords.clear();
+    encodeChunks(data, chunk_size, codewords);
+    uint32_t encoded_chunk_size = getEncodedChunkSize(chunk_size);
+    uint8_t control_bits_amount = getControlBitsAmount(chunk_size);
+    for (size_t pos = 0; pos < codewords.size(); pos += encoded_chunk_size) {
+        for (uint8_t i = 0; i < control_bits_amount; i++) {
+            parity.push_back(codewords[pos + (1 << i) - 1]);
+        }
+    }
+}
+
+void HammingCode::buildCodewords(bitView data, bitView parity, uint16_t chunk_size, bits& codewords) {
+    codewords.clear();
+    encodeChunks(data, chunk_size, codewords);
+    uint32_t encoded_chunk_size = getEncodedChunkSize(chunk_size);
+    uint8_t control_bits_amount = getControlBitsAmount(chunk_size);
+    for (size_t chunk = 0; chunk * encoded_chunk_size < codewords.size(); chunk++) {
+        for (uint8_t i = 0; i < control_bits_amount; i++) {
+            codewords.set(chunk * encoded_chunk_size + (1 << i) - 1, parity[chunk * control_bits_amount + i]);
+        }
+    }
+}
+
 // Encodes char by char
 bits HammingCode::encodeString(const std::string& s) {
     bits result;
+    result.reserve(s.size() * BITS_IN_ENCODED_BYTE);
     for (char c : s) {
-        bits char_bits = toBits(c);
-        encodeChunk(char_bits);
-        extendBits(result, char_bits);
+        result.appendWord(ENCODE_TABLE[reverseByte(c)], BITS_IN_ENCODED_BYTE);
     }
     return result;
 }
 
-std::string HammingCode::decodeString(const bits& encoded) {
-    std::string s;
-    for (int i = 0; i < encoded.size(); i += BITS_IN_ENCODED_BYTE) {
-        bits char_chunk = std::vector<bool>(encoded.begin() + i, encoded.begin() + i + BITS_IN_ENCODED_BYTE);
-        bool correct = decodeChunk(char_chunk, 4);
-        if (!correct) {
+std::string HammingCode::decodeString(bitView encoded) {
+    std::string s(encoded.size() / BITS_IN_ENCODED_BYTE, static_cast<char>(0));
+    for (size_t i = 0; i < s.size(); i++) {
+        uint16_t decoded = DECODE_TABLE[encoded.getWord(i * BITS_IN_ENCODED_BYTE, BITS_IN_ENCODED_BYTE)];
+        if (decoded & DECODED_INVALID) {
             return std::string();
         }
-        s += fromBits<char>(char_chunk);
+        s[i] = static_cast<char>(reverseByte(static_cast<char>(decoded)));
     }
     return s;
 }
 
-bits HammingCode::calculateControlBits(const bits& extended_chunk,
-                                       uint8_t control_bits_amount) {
-    bits control_bits(control_bits_amount);
-
-    for (uint8_t control_bit = 0; control_bit < control_bits_amount; control_bit++) {
-        uint32_t control_pos = (1 << control_bit) - 1; // 2^(control_bit) - 1
-        for (uint32_t i = control_pos; i < extended_chunk.size(); i += 2 * control_pos + 2) {
-            for (uint32_t j = 0; j < control_pos + 1; j++) {
-                control_bits[control_bit] = control_bits[control_bit] != extended_chunk[i + j]; // XOR
-            }
-        }
+void HammingCode::encodeBytes(const unsigned char* data, size_t size, bits& encoded) {
+    encoded.reserve(encoded.size() + size * BITS_IN_ENCODED_BYTE);
+    size_t i = 0;
+    for (; i + BYTES_IN_BLOCK <= size; i += BYTES_IN_BLOCK) {
+        word block = static_cast<word>(ENCODE_TABLE[data[i]])
+            | static_cast<word>(ENCODE_TABLE[data[i + 1]]) << BITS_IN_ENCODED_BYTE
+            | static_cast<word>(ENCODE_TABLE[data[i + 2]]) << (2 * BITS_IN_ENCODED_BYTE)
+            | static_cast<word>(ENCODE_TABLE[data[i + 3]]) << (3 * BITS_IN_ENCODED_BYTE);
+        encoded.appendWord(block, BYTES_IN_BLOCK * BITS_IN_ENCODED_BYTE);
     }
+    for (; i < size; i++) {
+        encoded.appendWord(ENCODE_TABLE[data[i]], BITS_IN_ENCODED_BYTE);
+    }
+}
 
-    return control_bits;
+// Returns false if any byte has more than one error
+bool HammingCode::decodeBytes(bitView encoded, unsigned char* data) {
+    uint64_t corrected = 0;
+    return decodeBytes(encoded, data, corrected);
 }
 
-bool HammingCode::compareControlBits(const bits& first, const bits& second) {
-    return std::equal(first.begin(), first.end(), second.begin());
+bool HammingCode::decodeBytes(bitView encoded, unsigned char* data, uint64_t& corrected) {
+    size_t size = encoded.size() / BITS_IN_ENCODED_BYTE;
+    uint16_t flags = 0;
+    uint64_t corrected_amount = 0;
+    size_t i = 0;
+    for (; i + BYTES_IN_BLOCK <= size; i += BYTES_IN_BLOCK) {
+        word block = encoded.getWord(i * BITS_IN_ENCODED_BYTE, BYTES_IN_BLOCK * BITS_IN_ENCODED_BYTE);
+        for (uint8_t j = 0; j < BYTES_IN_BLOCK; j++) {
+            uint16_t decoded = DECODE_TABLE[(block >> (j * BITS_IN_ENCODED_BYTE)) & ENCODED_BYTE_MASK];
+            flags |= decoded;
+            corrected_amount += (decoded & DECODED_CORRECTED) != 0;
+            data[i + j] = static_cast<unsigned char>(decoded);
+        }
+    }
+    for (; i < size; i++) {
+        uint16_t decoded = DECODE_TABLE[encoded.getWord(i * BITS_IN_ENCODED_BYTE, BITS_IN_ENCODED_BYTE)];
+        flags |= decoded;
+        corrected_amount += (decoded & DECODED_CORRECTED) != 0;
+        data[i] = static_cast<unsigned char>(decoded);
+    }
+    corrected += corrected_amount;
+    return !(flags & DECODED_INVALID);
 }
 
-uint8_t HammingCode::getControlBitsAmount(uint16_t chunk_size) {
-    return getLog2(chunk_size) + 1;
+/*
+    Position of bit i of word w is p = 64w + i + 1, so its lower 6 bits depend only on i
+    and are collected with precomputed masks, while its upper bits are w (or w + 1 for the last bit)
+*/
+uint32_t HammingCode::calculateSyndrome(bitView extended_chunk) {
+    uint32_t low = 0;
+    uint32_t high = 0;
+    for (size_t w = 0; w * BITS_IN_WORD < extended_chunk.size(); w++) {
+        uint8_t amount = std::min<size_t>(BITS_IN_WORD, extended_chunk.size() - w * BITS_IN_WORD);
+        word value = extended_chunk.getWord(w * BITS_IN_WORD, amount);
+        for (uint8_t k = 0; k < LOW_POSITION_BITS; k++) {
+            low ^= (std::popcount(value & LOW_POSITION_MASKS[k]) & 1) << k;
+        }
+        if (std::popcount(value & ~(word(1) << (BITS_IN_WORD - 1))) & 1) {
+            high ^= w;
+        }
+        if (value >> (BITS_IN_WORD - 1)) {
+            high ^= w + 1;
+        }
+    }
+    return low | (high << LOW_POSITION_BITS);
 }
 
-uint32_t HammingCode::getEncodedChunkSize(uint16_t chunk_size) {
-    uint8_t control_bits_amount = getControlBitsAmount(chunk_size); // always <= 17
-    uint32_t encoded_chunk_size = chunk_size + control_bits_amount;
-    return encoded_chunk_size;
+// Value bits occupy runs between control positions 2^k and 2^(k+1)
+void HammingCode::placeValueBits(bitView chunk, bits& encoded_chunk) {
+    size_t placed = 0;
+    for (size_t run_start = 2; run_start < encoded_chunk.size() && placed < chunk.size(); run_start <<= 1) {
+        size_t run_length = std::min({run_start - 1, encoded_chunk.size() - run_start, chunk.size() - placed});
+        encoded_chunk.copy(run_start, chunk.view(placed, run_length));
+        placed += run_length;
+    }
 }
 
-void HammingCode::extendBits(bits& a, const bits& b) {
-    for (bool el : b) {
-        a.push_back(el);
+void HammingCode::extractValueBits(bitView encoded_chunk, bits& chunk) {
+    size_t extracted = 0;
+    for (size_t run_start = 2; run_start < encoded_chunk.size() && extracted < chunk.size(); run_start <<= 1) {
+        size_t run_length = std::min({run_start - 1, encoded_chunk.size() - run_start, chunk.size() - extracted});
+        chunk.copy(extracted, encoded_chunk.view(run_start, run_length));
+        extracted += run_length;
     }
 }
 
-bool HammingCode::isPowerOfTwo(uint32_t x) {
-    return x && !(x & (x - 1));
+uint8_t HammingCode::getControlBitsAmount(uint16_t chunk_size) {
+    return controlBitsAmount(chunk_size);
 }
 
-uint8_t HammingCode::getLog2(uint16_t x) {
-    uint8_t log = 0;
-    while (x) {
-        x >>= 1;
-        log++;
+/*
+    Probability of two or more errors in an encoded chunk when every bit flips on its own
+    with probability bit_error_rate. Summed term by term, as 1 - P(no errors) - P(one error)
+    loses all precision for small rates
+*/
+double HammingCode::getFailureProbability(uint32_t encoded_chunk_size, double bit_error_rate) {
+    const double PRECISION = 1e-12;
+    double ratio = bit_error_rate / (1 - bit_error_rate);
+    double term = 0.5 * encoded_chunk_size * (encoded_chunk_size - 1) * bit_error_rate * bit_error_rate
+        * std::pow(1 - bit_error_rate, encoded_chunk_size - 2.0);
+    double probability = 0;
+    for (uint32_t errors = 2; errors <= encoded_chunk_size; errors++) {
+        probability += term;
+        if (term < probability * PRECISION && errors > encoded_chunk_size * bit_error_rate) {
+            break;
+        }
+        term *= ratio * (encoded_chunk_size - errors) / (errors + 1);
     }
-    return log - 1;
+    return std::min(probability, 1.0);
+}
+
+uint32_t HammingCode::getEncodedChunkSize(uint16_t chunk_size) {
+    uint8_t control_bits_amount = getControlBitsAmount(chunk_size); // always <= 17
+    uint32_t encoded_chunk_size = chunk_size + control_bits_amount;
+    return encoded_chunk_size;
 }
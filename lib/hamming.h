@@ -1,38 +1,95 @@
 #pragma once
 
 #include "bitstream.h"
+#include <span>
 #include <string>
 
 using Bits::bits;
+using Bits::bitView;
 using Bits::BITS_IN_BYTE;
 using Bits::toBits;
 using Bits::fromBits;
 
+/*
+    Bit at index i of an encoded chunk has position i + 1.
+    Control bits are placed at power of two positions, value bits fill the rest in order.
+*/
 class HammingCode {
  public:
   static void encodeChunk(bits&);
 
+  // Replaces encoded_chunk with the code of chunk, doesn't allocate when it already has the encoded size
+  static void encodeChunk(bitView chunk, bits& encoded_chunk);
+
   static bool decodeChunk(bits& encoded_chunk, uint8_t);
 
+  // Sets corrected when a single error was fixed
+  static bool decodeChunk(bits& encoded_chunk, uint8_t control_bits_amount, bool& corrected);
+
+  // Replaces chunk with value bits of encoded_chunk, doesn't allocate when it already has the chunk size
+  static bool decodeChunk(bitView encoded_chunk, uint8_t control_bits_amount, bits& chunk, bool& corrected);
+
+  // Position of a single error, zero for a valid codeword and above its size when it can't be corrected
+  static uint32_t getErrorPosition(bitView encoded_chunk);
+
+  // Encodes data split into chunks of chunk_size bits and appends the codewords, the last chunk is padded
+  // with zeros. Common chunk sizes are encoded by HammingCodec specializations
+  static void encodeChunks(bitView data, uint16_t chunk_size, bits& encoded);
+
+  // Appends value bits of every codeword, returns false if a codeword has several errors
+  static bool decodeChunks(bitView encoded, uint16_t chunk_size, bits& decoded, uint64_t& corrected);
+
+  /*
+      Block API for buffers reused between calls, nothing is allocated once they have grown to the block size.
+      encodeInto replaces encoded with the code of data, decodeInto decodes data.size() bytes.
+      scratch holds bits of chunks other than bytes
+  */
+  static void encodeInto(std::span<const unsigned char> data, uint16_t chunk_size, bits& encoded, bits& scratch);
+
+  static bool decodeInto(bitView encoded, uint16_t chunk_size, std::span<unsigned char> data, bits& scratch,
+                         uint64_t& corrected);
+
+  /*
+      Systematic form of the code, where value bits are stored apart from control bits.
+      encodeParity appends control bits of every chunk of data, the last chunk is padded with zeros,
+      codewords is a buffer for the encoded chunks. buildCodewords replaces codewords with chunks of data
+      encoded with the given control bits, so decodeChunks corrects an error in either of them
+  */
+  static void encodeParity(bitView data, uint16_t chunk_size, bits& parity, bits& codewords);
+
+  static void buildCodewords(bitView data, bitView parity, uint16_t chunk_size, bits& codewords);
+
   static bits encodeString(const std::string& s);
 
-  static std::string decodeString(const bits& encoded);
+  static std::string decodeString(bitView encoded);
+
+  // Table driven Hamming(12, 8) over byte buffers, value bit i is bit i of a byte.
+  // encodeBytes appends 12 bits per byte, decodeBytes decodes encoded.size() / 12 bytes
+  static void encodeBytes(const unsigned char* data, size_t size, bits& encoded);
+
+  static bool decodeBytes(bitView encoded, unsigned char* data);
+
+  // Adds the amount of bytes with a fixed error to corrected
+  static bool decodeBytes(bitView encoded, unsigned char* data, uint64_t& corrected);
 
   static uint8_t getControlBitsAmount(uint16_t chunk_size);
 
   static uint32_t getEncodedChunkSize(uint16_t chunk_size);
 
- private:
+  // Probability that an encoded chunk gets an error which can't be corrected
+  static double getFailureProbability(uint32_t encoded_chunk_size, double bit_error_rate);
 
-  static const uint8_t BITS_IN_ENCODED_BYTE = 12; // char is 8 bits + 4 control bits
+  static constexpr uint16_t BYTE_CHUNK_SIZE = 8; // Chunk size handled by encodeBytes and decodeBytes
 
-  [[nodiscard]] static bits calculateControlBits(const bits& chunk, uint8_t);
+  static constexpr uint8_t BITS_IN_ENCODED_BYTE = 12; // char is 8 bits + 4 control bits
 
-  static bool compareControlBits(const bits& first, const bits& second);
+ private:
 
-  static void extendBits(bits&, const bits&);
+  // XOR of positions of all set bits, zero for a valid code
+  static uint32_t calculateSyndrome(bitView extended_chunk);
 
-  static uint8_t getLog2(uint16_t);
+  // Copies value bits between their places in chunk and in the encoded chunk
+  static void placeValueBits(bitView chunk, bits& encoded_chunk);
 
-  static bool isPowerOfTwo(uint32_t);
+  static void extractValueBits(bitView encoded_chunk, bits& chunk);
 };
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "bitstream.h"
+#include <array>
+#include <bit>
+
+using Bits::bits;
+using Bits::bitView;
+using Bits::word;
+using Bits::BITS_IN_WORD;
+
+// Smallest r with 2^r > chunk_size + r, so every position of the encoded chunk gets a syndrome of its own
+constexpr uint8_t controlBitsAmount(uint16_t chunk_size) {
+    uint8_t control_bits_amount = std::bit_width(chunk_size);
+    if (chunk_size + control_bits_amount >= (uint32_t(1) << control_bits_amount)) {
+        control_bits_amount++;
+    }
+    return control_bits_amount;
+}
+
+/*
+    Hamming code of chunks of DataBits value bits, same as HammingCode::encodeChunk and
+    HammingCode::decodeChunk produce. Placement of value bits and parity masks are computed
+    at compile time, so a codeword is built in a fixed array of words without per bit branches.
+*/
+template<uint16_t DataBits>
+class HammingCodec {
+ public:
+  static constexpr uint8_t CONTROL_BITS = controlBitsAmount(DataBits);
+  static constexpr uint32_t ENCODED_BITS = DataBits + CONTROL_BITS;
+
+  // Appends codewords of data split into chunks, the last chunk is padded with zeros
+  static void encode(bitView data, bits& encoded) {
+      Codeword codeword;
+      size_t pos = 0;
+      for (; pos + DataBits <= data.size(); pos += DataBits) {
+          encodeChunk(data.view(pos, DataBits), codeword);
+          encoded.append(bitView(codeword.data(), 0, ENCODED_BITS));
+      }
+      if (pos < data.size()) {
+          encodeChunk(data.view(pos, data.size() - pos), codeword);
+          encoded.append(bitView(codeword.data(), 0, ENCODED_BITS));
+      }
+  }
+
+  // Appends value bits of every codeword of encoded, returns false at the first codeword with several errors
+  static bool decode(bitView encoded, bits& decoded, uint64_t& corrected) {
+      Codeword codeword;
+      for (size_t pos = 0; pos + ENCODED_BITS <= encoded.size(); pos += ENCODED_BITS) {
+          for (size_t w = 0; w < WORDS; w++) {
+              uint8_t amount = std::min<size_t>(BITS_IN_WORD, ENCODED_BITS - w * BITS_IN_WORD);
+              codeword[w] = encoded.getWord(pos + w * BITS_IN_WORD, amount);
+          }
+          uint32_t error_pos = calculateSyndrome(codeword);
+          if (error_pos) {
+              if (error_pos > ENCODED_BITS) {
+                  return false;
+              }
+              codeword[(error_pos - 1) / BITS_IN_WORD] ^= word(1) << (error_pos - 1) % BITS_IN_WORD;
+              corrected++;
+          }
+          for (const Piece& piece : PIECES) {
+              decoded.appendWord(Bits::loadBits(codeword.data(), piece.encoded_pos, piece.length), piece.length);
+          }
+      }
+      return true;
+  }
+
+ private:
+  static constexpr size_t WORDS = (ENCODED_BITS + BITS_IN_WORD - 1) / BITS_IN_WORD;
+
+  using Codeword = std::array<word, WORDS>;
+
+  // Run of value bits which doesn't cross a word boundary of the codeword or of the chunk
+  struct Piece {
+    uint32_t encoded_pos;
+    uint32_t data_pos;
+    uint8_t length;
+  };
+
+  static constexpr bool isControlPosition(uint32_t index) {
+      return std::has_single_bit(index + 1);
+  }
+
+  static constexpr size_t countPieces() {
+      size_t amount = 0;
+      uint32_t data_pos = 0;
+      for (uint32_t i = 0; i < ENCODED_BITS && data_pos < DataBits; i++) {
+          if (isControlPosition(i)) {
+              continue;
+          }
+          if (!i || isControlPosition(i - 1) || i % BITS_IN_WORD == 0 || data_pos % BITS_IN_WORD == 0) {
+              amount++;
+          }
+          data_pos++;
+      }
+      return amount;
+  }
+
+  static constexpr auto makePieces() {
+      std::array<Piece, countPieces()> pieces{};
+      size_t amount = 0;
+      uint32_t data_pos = 0;
+      for (uint32_t i = 0; i < ENCODED_BITS && data_pos < DataBits; i++) {
+          if (isControlPosition(i)) {
+              continue;
+          }
+          if (!i || isControlPosition(i - 1) || i % BITS_IN_WORD == 0 || data_pos % BITS_IN_WORD == 0) {
+              pieces[amount++] = {i, data_pos, 0};
+          }
+          pieces[amount - 1].length++;
+          data_pos++;
+      }
+      return pieces;
+  }
+
+  static constexpr auto PIECES = makePieces();
+
+  static constexpr uint8_t LOW_POSITION_BITS = 6; // Position bits that repeat inside each word
+
+  // PARITY_MASKS[k] marks bits of a word which positions have bit k set, k < LOW_POSITION_BITS
+  static constexpr auto makeParityMasks() {
+      std::array<word, LOW_POSITION_BITS> masks{};
+      for (uint8_t k = 0; k < LOW_POSITION_BITS; k++) {
+          for (uint8_t i = 0; i < BITS_IN_WORD; i++) {
+              if (((i + 1) >> k) & 1) {
+                  masks[k] |= word(1) << i;
+              }
+          }
+      }
+      return masks;
+  }
+
+  static constexpr auto PARITY_MASKS = makeParityMasks();
+
+  /*
+      XOR of positions of all set bits, zero for a valid codeword.
+      Position of bit i of word w is 64w + i + 1, so its lower 6 bits are collected from all words
+      folded together, while its upper bits are w (or w + 1 for the last bit of the word)
+  */
+  static uint32_t calculateSyndrome(const Codeword& codeword) {
+      word folded = 0;
+      uint32_t high = 0;
+      for (size_t w = 0; w < WORDS; w++) {
+          folded ^= codeword[w];
+          high ^= (std::popcount(codeword[w] & ~(word(1) << (BITS_IN_WORD - 1))) & 1) * w;
+          high ^= (codeword[w] >> (BITS_IN_WORD - 1)) * (w + 1);
+      }
+      uint32_t low = 0;
+      for (uint8_t k = 0; k < LOW_POSITION_BITS; k++) {
+          low |= (std::popcount(folded & PARITY_MASKS[k]) & 1) << k;
+      }
+      return low | (high << LOW_POSITION_BITS);
+  }
+
+  // Chunk shorter than DataBits is encoded as if padded with zeros
+  static void encodeChunk(bitView chunk, Codeword& codeword) {
+      codeword.fill(0);
+      for (const Piece& piece : PIECES) {
+          if (piece.data_pos >= chunk.size()) {
+              break;
+          }
+          uint8_t length = std::min<size_t>(piece.length, chunk.size() - piece.data_pos);
+          Bits::storeBits(codeword.data(), piece.encoded_pos, chunk.getWord(piece.data_pos, length), length);
+      }
+      uint32_t control_bits = calculateSyndrome(codeword);
+      for (uint8_t k = 0; k < CONTROL_BITS; k++) {
+          uint32_t control_pos = (1 << k) - 1;
+          codeword[control_pos / BITS_IN_WORD] |= word((control_bits >> k) & 1) << control_pos % BITS_IN_WORD;
+      }
+  }
+};
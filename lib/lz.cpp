@@ -0,0 +1,191 @@
+#include "lz.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+uint32_t LzCodec::hash(const unsigned char* sequence) {
+    uint32_t value;
+    std::memcpy(&value, sequence, sizeof(value));
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Length of the common prefix of a and b, at most limit bytes, compared by words
+size_t LzCodec::matchLength(const unsigned char* a, const unsigned char* b, size_t limit) {
+    size_t length = 0;
+    for (; length + sizeof(uint64_t) <= limit; length += sizeof(uint64_t)) {
+        uint64_t a_word;
+        uint64_t b_word;
+        std::memcpy(&a_word, a + length, sizeof(a_word));
+        std::memcpy(&b_word, b + length, sizeof(b_word));
+        if (a_word != b_word) {
+            return length + (std::endian::native == std::endian::little ? std::countr_zero(a_word ^ b_word)
+                                                                          : std::countl_zero(a_word ^ b_word)) / 8;
+        }
+    }
+    while (length < limit && a[length] == b[length]) {
+        length++;
+    }
+    return length;
+}
+
+// Rest of a length which didn't fit in its 4 bits of the token
+void LzCodec::appendLength(uint64_t length, std::vector<unsigned char>& compressed) {
+    for (; length >= UINT8_MAX; length -= UINT8_MAX) {
+        compressed.push_back(UINT8_MAX);
+    }
+    compressed.push_back(length);
+}
+
+// Match length of zero marks the last token, which has only literals
+void LzCodec::appendSequence(std::span<const unsigned char> literals,
+                             uint32_t offset,
+                             uint64_t match_length,
+                             std::vector<unsigned char>& compressed) {
+    uint64_t match_rest = match_length ? match_length - MIN_MATCH : 0;
+    uint8_t token = std::min<uint64_t>(literals.size(), LENGTH_MASK) << 4 | std::min<uint64_t>(match_rest, LENGTH_MASK);
+    compressed.push_back(token);
+    if (literals.size() >= LENGTH_MASK) {
+        appendLength(literals.size() - LENGTH_MASK, compressed);
+    }
+    compressed.insert(compressed.end(), literals.begin(), literals.end());
+    if (!match_length) {
+        return;
+    }
+    compressed.push_back(offset & UINT8_MAX);
+    compressed.push_back(offset >> 8);
+    if (match_rest >= LENGTH_MASK) {
+        appendLength(match_rest - LENGTH_MASK, compressed);
+    }
+}
+
+/*
+    head keeps the last position + 1 of every hash, chain keeps the previous position with the same hash
+    for positions within MAX_OFFSET. Level n follows at most 2^(n - 1) positions of a chain
+*/
+void LzCodec::compress(std::span<const unsigned char> data, uint8_t level, std::vector<unsigned char>& compressed) {
+    level = std::clamp(level, MIN_LEVEL, MAX_LEVEL);
+    uint32_t max_candidates = uint32_t(1) << (level - 1);
+    std::vector<uint32_t> head(size_t(1) << HASH_BITS, 0);
+    std::vector<uint32_t> chain(level > MIN_LEVEL ? MAX_OFFSET + 1 : 0);
+    const unsigned char* bytes = data.data();
+    size_t size = data.size();
+
+    auto insert = [&](size_t pos) {
+      uint32_t& last = head[hash(bytes + pos)];
+      if (!chain.empty()) {
+          chain[pos & MAX_OFFSET] = last;
+      }
+      last = pos + 1;
+    };
+
+    size_t anchor = 0; // Start of literals not written yet
+    size_t pos = 0;
+    while (pos + MIN_MATCH <= size) {
+        uint32_t candidate = head[hash(bytes + pos)];
+        size_t best_length = 0;
+        size_t best_offset = 0;
+        for (uint32_t i = 0; i < max_candidates && candidate && pos - (candidate - 1) <= MAX_OFFSET; i++) {
+            size_t match = candidate - 1;
+            size_t length = matchLength(bytes + match, bytes + pos, size - pos);
+            if (length > best_length) {
+                best_length = length;
+                best_offset = pos - match;
+            }
+            if (chain.empty() || pos + best_length == size) {
+                break;
+            }
+            uint32_t previous = chain[match & MAX_OFFSET];
+            if (previous >= candidate) { // Slot was reused by a later position
+                break;
+            }
+            candidate = previous;
+        }
+        insert(pos);
+        if (best_length < MIN_MATCH) {
+            pos += 1 + ((pos - anchor) >> SKIP_SHIFT);
+            continue;
+        }
+
+        appendSequence(data.subspan(anchor, pos - anchor), best_offset, best_length, compressed);
+        size_t match_end = pos + best_length;
+        if (chain.empty()) { // One more position keeps the next match close
+            pos = match_end - 2;
+        } else {
+            pos++;
+        }
+        for (; pos < match_end && pos + MIN_MATCH <= size; pos++) {
+            insert(pos);
+        }
+        pos = match_end;
+        anchor = pos;
+    }
+    appendSequence(data.subspan(anchor), 0, 0, compressed);
+}
+
+bool LzCodec::readLength(std::span<const unsigned char> compressed, size_t& pos, uint64_t& length) {
+    unsigned char byte;
+    do {
+        if (pos >= compressed.size()) {
+            return false;
+        }
+        byte = compressed[pos++];
+        length += byte;
+    } while (byte == UINT8_MAX);
+    return true;
+}
+
+bool LzCodec::decompress(std::span<const unsigned char> compressed, std::span<unsigned char> decompressed) {
+    size_t pos = 0;
+    size_t out = 0;
+    while (pos < compressed.size()) {
+        uint8_t token = compressed[pos++];
+        uint64_t literals = token >> 4;
+        if (literals == LENGTH_MASK && !readLength(compressed, pos, literals)) {
+            return false;
+        }
+        if (literals > compressed.size() - pos || literals > decompressed.size() - out) {
+            return false;
+        }
+        if (literals <= SHORT_COPY && compressed.size() - pos >= SHORT_COPY
+            && decompressed.size() - out >= SHORT_COPY) { // Copy of a fixed size is a couple of instructions
+            std::memcpy(decompressed.data() + out, compressed.data() + pos, SHORT_COPY);
+        } else {
+            std::memcpy(decompressed.data() + out, compressed.data() + pos, literals);
+        }
+        pos += literals;
+        out += literals;
+        if (pos == compressed.size()) { // Last token
+            break;
+        }
+
+        if (compressed.size() - pos < 2) {
+            return false;
+        }
+        size_t offset = compressed[pos] | compressed[pos + 1] << 8;
+        pos += 2;
+        uint64_t length = token & LENGTH_MASK;
+        if (length == LENGTH_MASK && !readLength(compressed, pos, length)) {
+            return false;
+        }
+        length += MIN_MATCH;
+        if (!offset || offset > out || length > decompressed.size() - out) {
+            return false;
+        }
+        unsigned char* target = decompressed.data() + out;
+        if (offset >= SHORT_COPY && length <= SHORT_COPY && decompressed.size() - out >= SHORT_COPY) {
+            std::memcpy(target, target - offset, SHORT_COPY);
+        } else if (offset >= length) {
+            std::memcpy(target, target - offset, length);
+        } else { // Match overlaps the bytes it produces, words are copied once they are produced
+            uint64_t i = 0;
+            for (; offset >= sizeof(uint64_t) && i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+                std::memcpy(target + i, target + i - offset, sizeof(uint64_t));
+            }
+            for (; i < length; i++) {
+                target[i] = target[i - offset];
+            }
+        }
+        out += length;
+    }
+    return out == decompressed.size();
+}
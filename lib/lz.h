@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/*
+    LZ77 block compression in the spirit of LZ4. Compressed block is a sequence of tokens:
+        token: 1 byte, amount of literals in the high 4 bits and match length - MIN_MATCH in the low 4 bits,
+            15 means that the rest follows as bytes of 255 ended by a smaller one
+        literals
+        match offset: 2 bytes, little endian, 1 to MAX_OFFSET bytes back
+    The last token has only literals. Matches are found by a hash table of 4 byte sequences,
+    higher levels follow chains of earlier positions with the same hash to find longer matches
+*/
+class LzCodec {
+ public:
+  // Appends compressed data to compressed
+  static void compress(std::span<const unsigned char> data, uint8_t level, std::vector<unsigned char>& compressed);
+
+  // Fills the whole decompressed, returns false if compressed is damaged or has another size
+  static bool decompress(std::span<const unsigned char> compressed, std::span<unsigned char> decompressed);
+
+  static constexpr uint8_t MIN_LEVEL = 1; // Greedy matching, a single candidate for each position
+  static constexpr uint8_t MAX_LEVEL = 9;
+
+ private:
+  static constexpr uint8_t MIN_MATCH = 4;
+  static constexpr uint32_t MAX_OFFSET = (1 << 16) - 1;
+  static constexpr uint8_t LENGTH_MASK = 15;
+  static constexpr uint8_t HASH_BITS = 16;
+  static constexpr uint8_t SKIP_SHIFT = 6; // Steps grow over data without matches
+  static constexpr size_t SHORT_COPY = 16; // Shorter copies write this many bytes when there is room
+
+  static size_t matchLength(const unsigned char* a, const unsigned char* b, size_t limit);
+
+  static uint32_t hash(const unsigned char* sequence);
+
+  static void appendLength(uint64_t length, std::vector<unsigned char>& compressed);
+
+  static void appendSequence(std::span<const unsigned char> literals,
+                             uint32_t offset,
+                             uint64_t match_length,
+                             std::vector<unsigned char>& compressed);
+
+  static bool readLength(std::span<const unsigned char> compressed, size_t& pos, uint64_t& length);
+};
@@ -0,0 +1,62 @@
+#include "mapping.h"
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAS_MMAP
+#endif
+
+MappedFile::~MappedFile() {
+    unmap();
+}
+
+bool MappedFile::map(const std::string& path) {
+    unmap();
+#ifdef HAS_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // Mapping stays valid without the descriptor
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    madvise(mapped, file_stat.st_size, MADV_SEQUENTIAL);
+    data = static_cast<const unsigned char*>(mapped);
+    size = file_stat.st_size;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void MappedFile::unmap() {
+#ifdef HAS_MMAP
+    if (data) {
+        munmap(const_cast<unsigned char*>(data), size);
+    }
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+void MappedFile::willNeed(uint64_t offset, uint64_t length) const {
+#ifdef HAS_MMAP
+    if (!data || offset >= size) {
+        return;
+    }
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t start = offset / page_size * page_size;
+    length = std::min(offset + length, size) - start;
+    madvise(const_cast<unsigned char*>(data) + start, length, MADV_WILLNEED);
+#endif
+}
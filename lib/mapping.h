@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file, available on POSIX systems
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Returns false if the file can't be mapped, the caller should fall back to stream reading
+  bool map(const std::string& path);
+
+  void unmap();
+
+  // Hints the kernel to read the range ahead
+  void willNeed(uint64_t offset, uint64_t length) const;
+
+  bool isMapped() const { return data != nullptr; }
+
+  const unsigned char* getData() const { return data; }
+
+  uint64_t getSize() const { return size; }
+
+ private:
+  const unsigned char* data = nullptr;
+  uint64_t size = 0;
+};
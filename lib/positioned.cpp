@@ -0,0 +1,89 @@
+#include "positioned.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#define HAS_PREAD
+#endif
+
+PositionedFile::~PositionedFile() {
+    close();
+}
+
+bool PositionedFile::open(const std::string& path, bool writable) {
+    close();
+#ifdef HAS_PREAD
+    fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+    return fd >= 0;
+#else
+    stream.open(path, std::ios::in | std::ios::binary | (writable ? std::ios::out : std::ios::openmode()));
+    return stream.is_open();
+#endif
+}
+
+void PositionedFile::close() {
+#ifdef HAS_PREAD
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+#else
+    stream.close();
+#endif
+}
+
+size_t PositionedFile::readAt(uint64_t offset, unsigned char* buffer, size_t size) const {
+#ifdef HAS_PREAD
+    size_t read_amount = 0;
+    while (read_amount < size) {
+        ssize_t result = pread(fd, buffer + read_amount, size - read_amount,
+                               static_cast<off_t>(offset + read_amount));
+        if (result < 0 && errno == EINTR) {
+            continue;
+        } else if (result <= 0) {
+            break;
+        }
+        read_amount += result;
+    }
+    return read_amount;
+#else
+    std::lock_guard<std::mutex> lock(stream_mutex);
+    stream.clear();
+    stream.seekg(static_cast<std::streamoff>(offset));
+    stream.read(reinterpret_cast<char*>(buffer), static_cast<std::streamsize>(size));
+    return stream.gcount();
+#endif
+}
+
+bool PositionedFile::writeAt(uint64_t offset, const unsigned char* buffer, size_t size) {
+#ifdef HAS_PREAD
+    size_t written_amount = 0;
+    while (written_amount < size) {
+        ssize_t result = pwrite(fd, buffer + written_amount, size - written_amount,
+                                static_cast<off_t>(offset + written_amount));
+        if (result < 0 && errno == EINTR) {
+            continue;
+        } else if (result <= 0) {
+            return false;
+        }
+        written_amount += result;
+    }
+    return true;
+#else
+    std::lock_guard<std::mutex> lock(stream_mutex);
+    stream.clear();
+    stream.seekp(static_cast<std::streamoff>(offset));
+    stream.write(reinterpret_cast<const char*>(buffer), static_cast<std::streamsize>(size));
+    stream.flush();
+    return stream.good();
+#endif
+}
+
+bool PositionedFile::isOpen() const {
+#ifdef HAS_PREAD
+    return fd >= 0;
+#else
+    return stream.is_open();
+#endif
+}
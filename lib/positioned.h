@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+// File read and written at explicit offsets, so several threads can read it at once without a shared position
+class PositionedFile {
+ public:
+  PositionedFile() = default;
+  ~PositionedFile();
+
+  PositionedFile(const PositionedFile&) = delete;
+  PositionedFile& operator=(const PositionedFile&) = delete;
+
+  bool open(const std::string& path, bool writable = false);
+
+  void close();
+
+  // Reads up to size bytes at offset and returns the amount read, less only at the end of file
+  size_t readAt(uint64_t offset, unsigned char* buffer, size_t size) const;
+
+  // Returns false if not all bytes were written
+  bool writeAt(uint64_t offset, const unsigned char* buffer, size_t size);
+
+  bool isOpen() const;
+
+ private:
+  int fd = -1;
+  mutable std::fstream stream; // Used where pread isn't available
+  mutable std::mutex stream_mutex;
+};
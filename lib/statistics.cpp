@@ -0,0 +1,90 @@
+#include "statistics.h"
+
+namespace {
+const double NANOSECONDS_IN_SECOND = 1e9;
+const double BYTES_IN_MEGABYTE = 1 << 20;
+
+double toSeconds(uint64_t nanoseconds) {
+    return nanoseconds / NANOSECONDS_IN_SECOND;
+}
+} // namespace
+
+std::string escapeJson(const std::string& s) {
+    std::string escaped;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            const char* hex = "0123456789abcdef";
+            escaped += "\\u00";
+            escaped += hex[c >> 4];
+            escaped += hex[c & 0xF];
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+void Statistics::addTime(std::atomic<uint64_t>& counter, Clock::time_point since) {
+    counter += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count();
+}
+
+void Statistics::add(const Statistics& other) {
+    bytes_read += other.bytes_read;
+    bytes_written += other.bytes_written;
+    codewords_encoded += other.codewords_encoded;
+    codewords_decoded += other.codewords_decoded;
+    io_time += other.io_time;
+    coding_time += other.coding_time;
+    files.insert(files.end(), other.files.begin(), other.files.end());
+}
+
+double Statistics::getTotalSeconds() const {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+double Statistics::getThroughput() const {
+    uint64_t payload = 0;
+    for (auto& file : files) {
+        payload += file.size;
+    }
+    double seconds = getTotalSeconds();
+    return seconds > 0 ? payload / BYTES_IN_MEGABYTE / seconds : 0;
+}
+
+void Statistics::printText(std::ostream& out) const {
+    out << "Bytes read: " << bytes_read << '\n'
+        << "Bytes written: " << bytes_written << '\n'
+        << "Codewords encoded: " << codewords_encoded << '\n'
+        << "Codewords decoded: " << codewords_decoded << '\n'
+        << "I/O time: " << toSeconds(io_time) << " s\n"
+        << "Encoding and decoding time: " << toSeconds(coding_time) << " s\n"
+        << "Total time: " << getTotalSeconds() << " s\n"
+        << "Throughput: " << getThroughput() << " MB/s\n";
+    for (auto& file : files) {
+        out << file.file_name << ": " << file.size << " bytes, " << file.codewords << " codewords, "
+            << file.corrected << " corrected\n";
+    }
+}
+
+void Statistics::printJson(std::ostream& out) const {
+    out << "{\"bytes_read\":" << bytes_read
+        << ",\"bytes_written\":" << bytes_written
+        << ",\"codewords_encoded\":" << codewords_encoded
+        << ",\"codewords_decoded\":" << codewords_decoded
+        << ",\"io_seconds\":" << toSeconds(io_time)
+        << ",\"coding_seconds\":" << toSeconds(coding_time)
+        << ",\"total_seconds\":" << getTotalSeconds()
+        << ",\"mb_per_s\":" << getThroughput()
+        << ",\"files\":[";
+    for (size_t i = 0; i < files.size(); i++) {
+        out << (i ? "," : "")
+            << "{\"name\":\"" << escapeJson(files[i].file_name) << "\""
+            << ",\"size\":" << files[i].size
+            << ",\"codewords\":" << files[i].codewords
+            << ",\"corrected\":" << files[i].corrected << "}";
+    }
+    out << "]}\n";
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Escapes quotes, backslashes and control characters of a string put in JSON output
+std::string escapeJson(const std::string& s);
+
+struct FileStatistics {
+  std::string file_name;
+  uint64_t size = 0; // Bytes of the file
+  uint64_t codewords = 0;
+  uint64_t corrected = 0; // Codewords with a fixed single error
+};
+
+/*
+    Counters of archive operations.
+    Times are summed over all threads, so I/O and coding times may exceed the total time
+    when pool threads work at once
+*/
+struct Statistics {
+  using Clock = std::chrono::steady_clock;
+
+  std::atomic<uint64_t> bytes_read = 0;
+  std::atomic<uint64_t> bytes_written = 0;
+  std::atomic<uint64_t> codewords_encoded = 0;
+  std::atomic<uint64_t> codewords_decoded = 0;
+  std::atomic<uint64_t> io_time = 0; // Nanoseconds
+  std::atomic<uint64_t> coding_time = 0;
+  Clock::time_point start = Clock::now();
+
+  std::vector<FileStatistics> files;
+
+  // Adds the time passed since `since` to counter
+  static void addTime(std::atomic<uint64_t>& counter, Clock::time_point since);
+
+  // Adds counters and files of an operation done by another archive
+  void add(const Statistics& other);
+
+  void printText(std::ostream& out) const;
+
+  void printJson(std::ostream& out) const;
+
+ private:
+  double getTotalSeconds() const;
+
+  // Payload bytes of processed files per second of total time
+  double getThroughput() const;
+};
@@ -0,0 +1,44 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(size_t threads_amount) {
+    for (size_t i = 0; i < threads_amount; i++) {
+        workers.emplace_back(&ThreadPool::work, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    has_task.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Tasks executed at the same time
+size_t ThreadPool::size() const {
+    return std::max<size_t>(workers.size(), 1);
+}
+
+size_t ThreadPool::defaultThreadsAmount() {
+    return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+// Runs tasks until the pool is destroyed and the queue is empty
+void ThreadPool::work() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            has_task.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
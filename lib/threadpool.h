@@ -0,0 +1,48 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads executing submitted tasks in submission order.
+// Pool without threads runs every task in the submitting thread
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t threads_amount);
+  ~ThreadPool();
+
+  template<typename F>
+  auto submit(F task) -> std::future<decltype(task())> {
+      using Result = decltype(task());
+      auto packaged_task = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+      std::future<Result> result = packaged_task->get_future();
+      if (workers.empty()) {
+          (*packaged_task)();
+          return result;
+      }
+      {
+          std::lock_guard<std::mutex> lock(mutex);
+          tasks.emplace([packaged_task] { (*packaged_task)(); });
+      }
+      has_task.notify_one();
+      return result;
+  }
+
+  size_t size() const;
+
+  static size_t defaultThreadsAmount();
+
+ private:
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable has_task;
+  bool stopping = false;
+
+  void work();
+};
@@ -0,0 +1,70 @@
+#include "verification.h"
+#include "statistics.h"
+
+bool Verification::isRecoverable() const {
+    if (header_damaged || !complete) {
+        return false;
+    }
+    for (auto& file : files) {
+        if (file.header_damaged || file.damaged_amount) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Verification::printText(std::ostream& out) const {
+    out << "Archive header: " << (header_damaged ? "damaged" : "valid")
+        << ", " << header_corrected << " corrected\n"
+        << "Index: " << (index_valid ? "valid" : "missing or damaged")
+        << ", " << index_corrected << " corrected\n";
+    if (!complete) {
+        out << "Files after the last listed one can't be located\n";
+    }
+    for (auto& file : files) {
+        out << (file.file_name.empty() ? "<unknown>" : file.file_name) << " at bit " << file.offset
+            << (file.deleted ? " (deleted)" : "") << ": header "
+            << (file.header_damaged ? "damaged" : "valid") << ", " << file.header_corrected << " corrected; "
+            << file.codewords << " codewords, " << file.corrected << " corrected, "
+            << file.damaged_amount << " damaged\n";
+        for (uint64_t offset : file.damaged) {
+            out << "    damaged codeword at bit " << offset << '\n';
+        }
+        if (file.damaged.size() < file.damaged_amount) {
+            out << "    ... " << file.damaged_amount - file.damaged.size() << " more\n";
+        }
+    }
+    if (repaired) {
+        out << "Repaired " << repaired << " errors\n";
+    }
+    out << (isRecoverable() ? "Archive is recoverable\n" : "Archive has damage which can't be corrected\n");
+}
+
+void Verification::printJson(std::ostream& out) const {
+    out << "{\"recoverable\":" << (isRecoverable() ? "true" : "false")
+        << ",\"header_corrected\":" << header_corrected
+        << ",\"header_damaged\":" << (header_damaged ? "true" : "false")
+        << ",\"index_valid\":" << (index_valid ? "true" : "false")
+        << ",\"index_corrected\":" << index_corrected
+        << ",\"repaired\":" << repaired
+        << ",\"complete\":" << (complete ? "true" : "false")
+        << ",\"files\":[";
+    for (size_t i = 0; i < files.size(); i++) {
+        const FileVerification& file = files[i];
+        out << (i ? "," : "")
+            << "{\"name\":\"" << escapeJson(file.file_name) << "\""
+            << ",\"offset\":" << file.offset
+            << ",\"deleted\":" << (file.deleted ? "true" : "false")
+            << ",\"header_corrected\":" << file.header_corrected
+            << ",\"header_damaged\":" << (file.header_damaged ? "true" : "false")
+            << ",\"codewords\":" << file.codewords
+            << ",\"corrected\":" << file.corrected
+            << ",\"damaged_amount\":" << file.damaged_amount
+            << ",\"damaged\":[";
+        for (size_t j = 0; j < file.damaged.size(); j++) {
+            out << (j ? "," : "") << file.damaged[j];
+        }
+        out << "]}";
+    }
+    out << "]}\n";
+}
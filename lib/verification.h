@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Offsets are positions of codewords in archive, in bits
+struct FileVerification {
+  std::string file_name;
+  uint64_t offset = 0; // Position of the file header
+  bool deleted = false;
+  uint64_t header_corrected = 0;
+  bool header_damaged = false;
+  uint64_t codewords = 0;
+  uint64_t corrected = 0;
+  uint64_t damaged_amount = 0;
+  std::vector<uint64_t> damaged; // First MAX_REPORTED_DAMAGE damaged codewords
+};
+
+struct Verification {
+  static constexpr size_t MAX_REPORTED_DAMAGE = 1000;
+
+  uint64_t header_corrected = 0; // Archive header
+  bool header_damaged = false;
+  bool index_valid = false; // Index at the archive tail was read
+  uint64_t index_corrected = 0;
+  uint64_t repaired = 0; // Errors written back to the archive by repair
+  bool complete = true; // False when a damaged header hides the files after it
+  std::vector<FileVerification> files;
+
+  // True when every codeword is valid or has a single error
+  bool isRecoverable() const;
+
+  void printText(std::ostream& out) const;
+
+  void printJson(std::ostream& out) const;
+};